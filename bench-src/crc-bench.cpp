@@ -0,0 +1,96 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../inc/crc.h"
+
+using namespace std;
+
+// What calculate_crc used to do, one table lookup per byte
+static uint8_t crc8_bytewise(const uint8_t *data, size_t size) {
+	uint8_t crc = 0;
+	for (size_t i = 0; i < size; i++) {
+		crc = crc8_table[crc ^ data[i]];
+	}
+	return crc;
+}
+
+static uint32_t crc32c_bitwise(const uint8_t *data, size_t size) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+		}
+	}
+	return ~crc;
+}
+
+static bool check(const vector<uint8_t> &buffer) {
+	const uint8_t *check_string = (const uint8_t *)"123456789";
+	if (crc32c(0, check_string, 9) != 0xE3069283) {
+		cout << "crc32c check value mismatch" << endl;
+		return false;
+	}
+
+	mt19937 gen(1);
+	uniform_int_distribution<size_t> lengths(0, buffer.size());
+	for (int i = 0; i < 2000; i++) {
+		size_t size = i < 64 ? i : lengths(gen);
+		size_t split = size / 3;
+		const uint8_t *data = buffer.data();
+		if (crc8(crc8(0, data, split), data + split, size - split) != crc8_bytewise(data, size)) {
+			cout << "crc8 mismatch at " << size << " bytes" << endl;
+			return false;
+		}
+		if (crc32c(crc32c(0, data, split), data + split, size - split) !=
+			crc32c_bitwise(data, size)) {
+			cout << "crc32c mismatch at " << size << " bytes" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename Checksum>
+static void measure(const char *name, size_t size, Checksum checksum) {
+	size_t rounds = max<size_t>(1, (64 << 20) / size);
+	uint32_t sink = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < rounds; i++) {
+		sink += checksum();
+	}
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+	double ns = elapsed.count() * 1e9 / rounds;
+	cout << "  " << left << setw(20) << name << right << setw(10) << fixed << setprecision(1) << ns
+		 << " ns" << setw(10) << setprecision(0) << size / ns * 1e3 << " MB/s"
+		 << (sink == 1 ? " " : "") << endl;
+}
+
+int main() {
+	vector<uint8_t> buffer(12000);
+	mt19937 gen(42);
+	for (uint8_t &byte : buffer) {
+		byte = gen();
+	}
+
+	if (!check(buffer)) {
+		return 1;
+	}
+	cout << "CRC-32C kernel: " << crc32c_kernel() << endl;
+
+	// a legacy frame, an ethernet sized one and a jumbo one
+	for (size_t size : {68, 1500, 9000}) {
+		const uint8_t *data = buffer.data();
+		cout << size << " bytes" << endl;
+		measure("crc8 table", size, [&]() { return crc8_bytewise(data, size); });
+		measure("crc8 slicing-by-8", size, [&]() { return crc8(0, data, size); });
+		measure("crc32c", size, [&]() { return crc32c(0, data, size); });
+	}
+	return 0;
+}
@@ -0,0 +1,173 @@
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../inc/compress.h"
+#include "../inc/frame.h"
+
+using namespace std;
+
+// A transport endpoint that keeps the last frame sent and hands a copy of it to every receive,
+// so encoding and decoding are measured without a kernel or a link in the way
+static vector<uint8_t> wire(MAX_WIRE_FRAME_SIZE);
+static size_t wire_length = 0;
+static vector<uint8_t> received(MAX_WIRE_FRAME_SIZE);
+static struct sockaddr_ll loop_peer;
+
+static ssize_t loop_receive(int, uint8_t **packet, int64_t) {
+	// decoding happens in place, every receive starts from the frame as it was sent
+	memcpy(received.data(), wire.data(), wire_length);
+	*packet = received.data();
+	return wire_length;
+}
+
+static void loop_send_batch(int, struct mmsghdr *messages, unsigned int count) {
+	const struct msghdr &last = messages[count - 1].msg_hdr;
+	wire_length = 0;
+	for (size_t i = 0; i < last.msg_iovlen; i++) {
+		memcpy(&wire[wire_length], last.msg_iov[i].iov_base, last.msg_iov[i].iov_len);
+		wire_length += last.msg_iov[i].iov_len;
+	}
+}
+
+static int loop_create_sender(int fd, const uint8_t *) {
+	return fd;
+}
+
+static void loop_set_peer(int, const uint8_t *) {}
+
+static const uint8_t *loop_last_source(int) {
+	return loop_peer.sll_addr;
+}
+
+static const struct sockaddr_ll *loop_peer_address(int) {
+	return &loop_peer;
+}
+
+static void loop_close(int fd) {
+	close(fd);
+}
+
+static const TransportOps loop_transport = {
+	loop_receive,	  loop_send_batch,	 loop_create_sender, loop_set_peer,
+	loop_last_source, loop_peer_address, loop_close,
+};
+
+template <typename Operation>
+static void measure(const char *name, const char *format, size_t payload, Operation operation) {
+	size_t rounds = max<size_t>(1000, (256 << 20) / (payload + LARGE_HEADER_SIZE));
+	uint64_t sink = 0;
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < rounds; i++) {
+		sink += operation();
+	}
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+	double ns = elapsed.count() * 1e9 / rounds;
+	cout << name << "," << format << "," << payload << "," << fixed << setprecision(1) << ns << ","
+		 << setprecision(0) << 1e9 / ns << "," << setprecision(1) << payload / ns * 1e3
+		 << (sink == 1 ? " " : "") << endl;
+	cout.unsetf(ios::floatfield);
+}
+
+// Log lines with counters in them, about as compressible as a server log
+static vector<uint8_t> log_block(mt19937 &gen) {
+	const char *words[] = {"frame", "window", "ack", "timeout", "session", "payload"};
+	string text;
+	while (text.size() < COMPRESS_BLOCK_BYTES) {
+		text += to_string(1700000000 + text.size()) + " [INFO] " + words[gen() % 6] + " seq=" +
+				to_string(gen() % 65536) + " rtt=" + to_string(gen() % 5000) + "us\n";
+	}
+	return vector<uint8_t>(text.begin(), text.begin() + COMPRESS_BLOCK_BYTES);
+}
+
+// Encoding, decoding and checksumming one frame in each wire format, one CSV line each.
+// Encoding includes queueing into a TxBatch, decoding includes the checksum check.
+// Then compressing a block of log lines and one of random bytes, which is stored as it is
+int main() {
+	int fd = eventfd(0, EFD_CLOEXEC);
+	if (fd < 0) {
+		perror("Failed to create loop endpoint");
+		return 1;
+	}
+	memset(&loop_peer, 0xFF, sizeof(loop_peer));
+	transport_register(fd, &loop_transport);
+
+	Frame frame = {};
+	mt19937 gen(42);
+	for (uint8_t &byte : frame.data) {
+		byte = gen();
+	}
+	frame.start_marker = START_MARKER;
+	frame.type = TYPE_DATA;
+	frame.session = 1;
+	TxBatch batch;
+	tx_batch_init(batch, fd);
+
+	const FrameFormat formats[] = {FORMAT_LEGACY, FORMAT_LARGE, FORMAT_LARGE_CRC32C};
+	const char *format_names[] = {"legacy", "large", "large-crc32c"};
+	cout << "operation,format,payload,ns_per_frame,frames_per_s,mb_per_s" << endl;
+	for (int f = 0; f < 3; f++) {
+		FrameFormat format = formats[f];
+		vector<uint16_t> payloads = {FRAME_DATA_SIZE};
+		if (format != FORMAT_LEGACY) {
+			payloads = {FRAME_DATA_SIZE, max_payload_for_mtu(ETH_DATA_LEN), MAX_FRAME_DATA_SIZE};
+		}
+		for (uint16_t payload : payloads) {
+			frame.length = payload;
+			frame.crc = calculate_crc(frame);
+			// the 8 bit crc of the legacy and large formats, over a frame of this payload
+			if (format == FORMAT_LARGE) {
+				measure("calculate_crc", format_names[f], payload,
+						[&]() { return calculate_crc(frame); });
+			}
+			measure("encode", format_names[f], payload, [&]() {
+				frame.sequence++;
+				queue_frame(batch, frame, format);
+				return batch.count;
+			});
+			flush_frames(batch);
+			measure("decode", format_names[f], payload, [&]() {
+				const Frame *decoded = receive_frame_view(fd, 0);
+				return decoded != nullptr && frame_intact(*decoded) ? decoded->length : 0;
+			});
+		}
+	}
+
+	vector<uint8_t> blocks[] = {log_block(gen), vector<uint8_t>(COMPRESS_BLOCK_BYTES)};
+	for (uint8_t &byte : blocks[1]) {
+		byte = gen();
+	}
+	const char *block_names[] = {"lz-log", "lz-random"};
+	vector<uint8_t> stored(COMPRESS_BLOCK_HEADER + COMPRESS_BLOCK_BYTES);
+	vector<uint8_t> raw(COMPRESS_BLOCK_BYTES);
+	for (int b = 0; b < 2; b++) {
+		size_t size = 0;
+		measure("compress", block_names[b], COMPRESS_BLOCK_BYTES, [&]() {
+			size = compress_block(blocks[b].data(), blocks[b].size(), stored.data());
+			return size;
+		});
+		BlockDecoder decoder;
+		block_decoder_init(decoder);
+		measure("decompress", block_names[b], COMPRESS_BLOCK_BYTES, [&]() {
+			block_decoder_feed(decoder, stored.data(), size, [&](const uint8_t *data, size_t length) {
+				memcpy(raw.data(), data, length);
+			});
+			return decoder.decoded;
+		});
+		if (raw != blocks[b]) {
+			cout << block_names[b] << " did not decompress to what was compressed" << endl;
+			return 1;
+		}
+	}
+
+	transport_close(fd);
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include "../inc/client.h"
+#include "sim-harness.h"
+
+using namespace std;
+
+// Value given to a command line option, nullptr when it wasn't given
+static const char *option_value(int argc, char **argv, const char *option) {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], option) == 0) {
+			return argv[i + 1];
+		}
+	}
+	return nullptr;
+}
+
+static double option_number(int argc, char **argv, const char *option, double otherwise) {
+	const char *value = option_value(argc, argv, option);
+	return value != nullptr ? atof(value) : otherwise;
+}
+
+// Runs the server and the client of this tree in one process over a simulated link and checks
+// the download arrived intact. Runs with the same options and seed see the same loss statistics,
+// not the same packets lost: which packet meets which decision follows the real clock and the
+// threads, so a failure found under loss or reordering may take a few runs to show again:
+//   ./link-sim --loss 0.02 --reorder 0.05 --reorder-us 2000 --seed 7 --file cat.mp4
+int main(int argc, char **argv) {
+	SimRun run;
+	run.link = sim_config_perfect();
+	run.link.latency_us = option_number(argc, argv, "--latency-us", 0);
+	run.link.bandwidth_bps = option_number(argc, argv, "--bandwidth-mbit", 0) * 1000000;
+	run.link.queue_bytes = option_number(argc, argv, "--queue-bytes", run.link.queue_bytes);
+	run.link.loss = option_number(argc, argv, "--loss", 0);
+	run.link.reorder = option_number(argc, argv, "--reorder", 0);
+	run.link.reorder_us = option_number(argc, argv, "--reorder-us", 1000);
+	run.link.duplicate = option_number(argc, argv, "--duplicate", 0);
+	run.link.corrupt = option_number(argc, argv, "--corrupt", 0);
+	run.link.seed = option_number(argc, argv, "--seed", 1);
+	run.mtu = option_number(argc, argv, "--mtu", ETH_DATA_LEN);
+	run.sessions = max((int)option_number(argc, argv, "--parallel", DOWNLOAD_SESSIONS), 1);
+	run.window_limit = option_number(argc, argv, "--window", WINDOW_MAX);
+	const char *file = option_value(argc, argv, "--file");
+	run.file = file != nullptr ? file : "";
+	// protocol logs are left out unless asked for, they cost more than the link
+	bool verbose = false;
+	for (int i = 1; i < argc; i++) {
+		verbose = verbose || strcmp(argv[i], "--verbose") == 0;
+	}
+
+	// the server serves ./videos and the client saves to ., so both run from a scratch directory
+	char *here = getcwd(nullptr, 0);
+	string videos = string(here) + "/videos";
+	free(here);
+	string scratch = scratch_enter();
+	if (symlink(videos.c_str(), "videos") < 0) {
+		perror("Failed to link videos");
+		exit(EXIT_FAILURE);
+	}
+
+	streambuf *console = cout.rdbuf();
+	if (!verbose) {
+		cout.rdbuf(nullptr);
+	}
+	SimResult result = sim_run(run);
+	cout.rdbuf(console);
+	scratch_remove(scratch);
+
+	if (result.file.empty()) {
+		cout << "No files listed" << endl;
+		return 1;
+	}
+	cout << result.file << (result.intact ? " arrived intact" : " arrived DIFFERENT") << " in "
+		 << fixed << setprecision(3) << result.seconds << " s, " << setprecision(1)
+		 << result.bytes * 8 / result.seconds / 1e6 << " Mbit/s, " << result.retransmits
+		 << " frames resent" << endl;
+	cout << "packets sent " << result.link.sent << ", lost " << result.link.lost << ", queue drops "
+		 << result.link.queue_drops << ", reordered " << result.link.reordered << ", duplicated "
+		 << result.link.duplicated << ", corrupted " << result.link.corrupted << endl;
+	return result.intact ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include "sim-harness.h"
+
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#include "../inc/client.h"
+#include "../inc/server.h"
+
+static const uint8_t server_mac[ETH_ALEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t client_mac[ETH_ALEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+static bool same_contents(const string &path, const string &other) {
+	ifstream a(path, ios::binary), b(other, ios::binary);
+	if (!a || !b) {
+		return false;
+	}
+	return equal(istreambuf_iterator<char>(a), istreambuf_iterator<char>(),
+				 istreambuf_iterator<char>(b), istreambuf_iterator<char>());
+}
+
+SimResult sim_run(const SimRun &run) {
+	SimNetwork network;
+	sim_network_init(network, run.link);
+	int server_fd = sim_endpoint_create(network, server_mac, TIMEOUT_SECONDS);
+	int client_fd = sim_endpoint_create(network, client_mac, TIMEOUT_SECONDS);
+	TransferStats stats;
+	stats.frames_sent = 0;
+	stats.retransmits = 0;
+	stats.first_data_at = 0;
+
+	// stop is written once the client is done, the server loop returns on it
+	int stop = eventfd(0, EFD_CLOEXEC);
+	if (stop < 0) {
+		perror("Failed to create stop event");
+		exit(EXIT_FAILURE);
+	}
+	thread server([&]() {
+		WorkerPool pool;
+		pool_start(pool, WORKER_THREADS);
+		Reactor reactor;
+		reactor_init(reactor);
+		Dispatcher dispatcher;
+		dispatcher_init(dispatcher, server_fd, TIMEOUT_SECONDS, local_options(run.mtu), pool);
+		dispatcher.window_limit = run.window_limit;
+		dispatcher.stats = &stats;
+		// the last ack of the client may still be on the link, sessions are left to end first
+		int idle_check = reactor_create_timer(reactor);
+		reactor_watch(reactor, idle_check, [&]() {
+			lock_guard<mutex> guard(dispatcher.lock);
+			if (dispatcher.sessions.empty()) {
+				reactor_stop(reactor);
+			} else {
+				reactor_arm_timer(idle_check, 1000);
+			}
+		});
+		reactor_watch(reactor, stop, [&]() {
+			uint64_t count;
+			if (read(stop, &count, sizeof(count)) > 0) {
+				reactor_arm_timer(idle_check, 1000);
+			}
+		});
+		dispatch_requests(dispatcher, reactor);
+		pool_stop(pool);
+		catalog_close(dispatcher.catalog);
+		frame_cache_close(dispatcher.cache);
+		reactor_close(reactor);
+	});
+
+	SimResult result = {};
+	Reactor reactor;
+	reactor_init(reactor);
+	Session session;
+	session_init(session, reactor, client_fd, TIMEOUT_SECONDS, local_options(run.mtu));
+	vector<RemoteFile> file_list = list_files(session);
+	session.stats = &stats;
+	const RemoteFile *remote = file_list.empty() ? nullptr : &file_list[0];
+	for (const RemoteFile &file : file_list) {
+		if (file.name == run.file) {
+			remote = &file;
+		}
+	}
+	int64_t start = now_us();
+	if (remote != nullptr) {
+		download_file(session, *remote, run.sessions);
+	}
+	int64_t end = now_us();
+	result.payload_size = session.options.payload_size;
+	session_close(session);
+	reactor_close(reactor);
+
+	uint64_t one = 1;
+	if (write(stop, &one, sizeof(one)) < 0) {
+		perror("Failed to stop server");
+	}
+	server.join();
+	close(stop);
+	transport_close(client_fd);
+	transport_close(server_fd);
+
+	if (remote != nullptr) {
+		result.file = remote->name;
+		result.intact = same_contents(remote->name, "videos/" + remote->name);
+		struct stat st;
+		result.bytes = stat(remote->name.c_str(), &st) == 0 ? st.st_size : 0;
+		unlink(remote->name.c_str());
+		unlink((remote->name + JOURNAL_SUFFIX).c_str());
+	}
+	result.seconds = (end - start) / 1e6;
+	result.first_byte_seconds = stats.first_data_at > 0 ? (stats.first_data_at - start) / 1e6 : 0;
+	result.frames_sent = stats.frames_sent;
+	result.retransmits = stats.retransmits;
+	result.rtts = stats.rtts;
+	sort(result.rtts.begin(), result.rtts.end());
+	result.link = sim_network_stats(network);
+	return result;
+}
+
+string scratch_enter() {
+	char scratch[] = "/tmp/link-sim-XXXXXX";
+	if (mkdtemp(scratch) == nullptr || chdir(scratch) < 0) {
+		perror("Failed to prepare scratch directory");
+		exit(EXIT_FAILURE);
+	}
+	return scratch;
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+	return remove(path);
+}
+
+void scratch_remove(const string &scratch) {
+	nftw(scratch.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
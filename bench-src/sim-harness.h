@@ -0,0 +1,44 @@
+#ifndef SIM_HARNESS_H
+#define SIM_HARNESS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../inc/sim-network.h"
+
+using namespace std;
+
+// One download by the server and client of this tree, in one process over a simulated link.
+// Both run in the working directory: the server serves ./videos, the client saves next to it
+struct SimRun {
+	SimConfig link;
+	int mtu;
+	int sessions;	   // the client splits the download over that many
+	int window_limit;  // of the server, see Session
+	string file;	   // to download, the first one listed when empty
+};
+
+struct SimResult {
+	string file;  // empty when nothing was listed
+	bool intact;  // arrived like the server has it
+	uint64_t bytes;
+	uint16_t payload_size;		 // that was agreed on
+	double seconds;				 // from the download request to the last byte on disk
+	double first_byte_seconds;	 // from the download request to the first data frame
+	uint64_t frames_sent;		 // by the server, see TransferStats
+	uint64_t retransmits;
+	vector<int64_t> rtts;  // sorted
+	SimStats link;
+};
+
+// Runs the download, the downloaded copy is removed once compared
+SimResult sim_run(const SimRun &run);
+
+// Creates a scratch directory and makes it the working directory
+string scratch_enter();
+
+// Removes the scratch directory and everything in it, links are not followed
+void scratch_remove(const string &scratch);
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../inc/client.h"
+#include "sim-harness.h"
+
+using namespace std;
+
+// Value at fraction of the sorted samples, 0 without any
+static int64_t percentile(const vector<int64_t> &sorted, double fraction) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	return sorted[min(sorted.size() - 1, (size_t)(fraction * sorted.size()))];
+}
+
+// Random bytes, so nothing along the way can do better than the protocol
+static void generate_file(const string &path, size_t size) {
+	mt19937 gen(size);
+	vector<uint32_t> words((size + 3) / 4);
+	for (uint32_t &word : words) {
+		word = gen();
+	}
+	ofstream out(path, ios::binary);
+	out.write((const char *)words.data(), size);
+}
+
+// Downloads generated files over the simulated link, sweeping file size, window, payload size
+// and loss. One CSV line per download on stdout, protocol logs are left out:
+//   ./transfer-bench [--latency-us 200] [--seed 1] [--quick]
+int main(int argc, char **argv) {
+	int64_t latency_us = 200;
+	uint32_t seed = 1;
+	bool quick = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--latency-us") == 0 && i + 1 < argc) {
+			latency_us = atoll(argv[++i]);
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			seed = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--quick") == 0) {
+			quick = true;
+		}
+	}
+
+	vector<size_t> sizes = {64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+	vector<int> windows = {8, 64, WINDOW_MAX};
+	vector<int> mtus = {ETH_DATA_LEN, MAX_FRAME_DATA_SIZE};
+	vector<double> losses = {0, 0.01, 0.05};
+	if (quick) {
+		sizes = {1024 * 1024};
+		windows = {64};
+		losses = {0, 0.01};
+	}
+
+	string scratch = scratch_enter();
+	if (mkdir("videos", 0755) < 0) {
+		perror("Failed to create videos");
+		exit(EXIT_FAILURE);
+	}
+
+	ostream out(cout.rdbuf());
+	cout.rdbuf(nullptr);
+	out << "bytes,window,payload,loss,seconds,mb_per_s,frames_per_s,frames_sent,retransmits,"
+		   "first_byte_us,rtt_p50_us,rtt_p99_us,intact"
+		<< endl;
+	bool all_intact = true;
+	for (size_t size : sizes) {
+		string name = "bench-" + to_string(size);
+		generate_file("videos/" + name, size);
+		for (int window : windows) {
+			for (int mtu : mtus) {
+				for (double loss : losses) {
+					SimRun run;
+					run.link = sim_config_perfect();
+					run.link.latency_us = latency_us;
+					run.link.loss = loss;
+					run.link.seed = seed;
+					run.mtu = mtu;
+					run.sessions = 1;
+					run.window_limit = window;
+					run.file = name;
+					SimResult result = sim_run(run);
+					all_intact = all_intact && result.intact;
+
+					out << size << "," << window << "," << result.payload_size << "," << loss << ","
+						<< fixed << setprecision(4) << result.seconds << "," << setprecision(2)
+						<< result.bytes / result.seconds / 1e6 << "," << setprecision(0)
+						<< result.frames_sent / result.seconds << "," << result.frames_sent << ","
+						<< result.retransmits << "," << result.first_byte_seconds * 1e6 << ","
+						<< percentile(result.rtts, 0.5) << "," << percentile(result.rtts, 0.99)
+						<< "," << (result.intact ? 1 : 0) << endl;
+					out.unsetf(ios::floatfield);
+				}
+			}
+		}
+	}
+
+	scratch_remove(scratch);
+	return all_intact ? 0 : 1;
+}
@@ -1,20 +1,49 @@
 #include "../inc/client.h"
 
+// Value given to a command line option, nullptr when it wasn't given
+static const char *option_value(int argc, char **argv, const char *option) {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], option) == 0) {
+			return argv[i + 1];
+		}
+	}
+	return nullptr;
+}
+
 /*===== CLIENT ====*/
-int main() {
+int main(int argc, char **argv) {
+	// --stream <output> plays the file as it arrives instead of saving it, "-" for stdout
+	const char *output = option_value(argc, argv, "--stream");
+	// --parallel <count> splits a download over that many sessions
+	const char *parallel = option_value(argc, argv, "--parallel");
+	int sessions = parallel != nullptr ? max(atoi(parallel), 1) : DOWNLOAD_SESSIONS;
+	int output_fd = -1;
+	if (output != nullptr && strcmp(output, "-") == 0) {
+		// the player owns stdout, everything else goes to stderr
+		output_fd = dup(STDOUT_FILENO);
+		cout.rdbuf(cerr.rdbuf());
+	}
+	// a player that quits ends the stream, it doesn't kill the client
+	signal(SIGPIPE, SIG_IGN);
+
 	const char *interface_name = INTERFACE_NAME;
 	int timeout_seconds = TIMEOUT_SECONDS;
 	int sockfd = raw_socket_create(interface_name, timeout_seconds);
+	Reactor reactor;
+	reactor_init(reactor);
+	Session session;
+	session_init(session, reactor, sockfd, timeout_seconds,
+				 local_options(get_interface_mtu(interface_name)));
 
 	cout << "Client started. Sending list request..." << endl;
-	vector<string> file_list = list_files(sockfd, timeout_seconds);
+	vector<RemoteFile> file_list = list_files(session);
 
 	if (!file_list.empty()) {
 		int choice;
 		while (true) {
 			cout << "Enter the number of the file you want to download: " << endl;
 			for (size_t i = 0; i < file_list.size(); ++i) {
-				cout << i + 1 << ": " << file_list[i] << endl;
+				cout << i + 1 << ": " << file_list[i].name << endl;
 			}
 
 			cin >> choice;
@@ -26,12 +55,29 @@ int main() {
 			}
 		}
 		
-		cout << file_list[choice - 1] << endl;
-		download_file(sockfd, file_list[choice - 1], timeout_seconds);
+		cout << file_list[choice - 1].name << endl;
+		if (output == nullptr) {
+			download_file(session, file_list[choice - 1], sessions);
+		} else {
+			// opening a fifo waits for the player
+			if (output_fd < 0) {
+				output_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			}
+			if (output_fd < 0) {
+				perror("Failed to open stream output");
+			} else {
+				stream_file(session, file_list[choice - 1], output_fd);
+			}
+		}
 	} else {
 		cout << "No files available for download" << endl;
 	}
 
-	close(sockfd);
+	session_close(session);
+	if (SHOW_LOGS == 1) {
+		cout << metrics_format(metrics_snapshot()) << endl;
+	}
+	reactor_close(reactor);
+	transport_close(sockfd);
 	return 0;
 }
@@ -0,0 +1,50 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+using namespace std;
+
+// A file the server offers
+struct CatalogEntry {
+	string name;
+	uint64_t size;
+	int64_t mtime;	 // seconds since the epoch
+	uint32_t hash;	 // CRC-32C of the contents, 0 unless CATALOG_HASH is on
+	int64_t mtime_ns;  // the same to the nanosecond, only the server has it
+};
+
+// The files of a directory kept in memory. Listing reads a snapshot, the directory is only
+// scanned again after inotify reported a change in it
+struct Catalog {
+	string directory;
+	int inotify_fd;	 // -1 when changes can't be watched, every listing scans then
+	mutex lock;
+	bool watching;	// false until the watch is set, and again once the directory went away
+	bool stale;
+	shared_ptr<const vector<CatalogEntry>> entries;
+	shared_ptr<const vector<uint8_t>> packed;  // entries as sent to clients
+};
+
+void catalog_open(Catalog &catalog, const string &directory);
+
+// Entries and their packed form as of now, false if the directory can't be read
+bool catalog_snapshot(Catalog &catalog, shared_ptr<const vector<CatalogEntry>> &entries,
+					  shared_ptr<const vector<uint8_t>> &packed);
+
+void catalog_close(Catalog &catalog);
+
+// Entries one after the other as [name length][name][size u64][mtime u64][hash u32],
+// big endian, so a listing streams like a file and frames hold as many as fit
+vector<uint8_t> catalog_pack(const vector<CatalogEntry> &entries);
+
+// Reads entries packed by catalog_pack, false if the data ends inside an entry
+bool catalog_unpack(const uint8_t *data, size_t size, vector<CatalogEntry> &entries);
+
+#endif
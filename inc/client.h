@@ -4,10 +4,15 @@
 #endif
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <random>
@@ -20,12 +25,46 @@
 #include <iomanip>
 #include <iostream>
 
+#include "catalog.h"
+#include "compress.h"
+#include "fec.h"
+#include "file-writer.h"
 #include "frame.h"
+#include "inbox.h"
+#include "journal.h"
+#include "options.h"
 #include "raw-socket.h"
+#include "session.h"
+#include "worker-pool.h"
 #include "config.h"
 
-// Request files available for download in server and print them
-vector<string> list_files(int sockfd, int timeout_seconds);
+// A file the server offers, size and mtime are 0 when the server didn't tell
+struct RemoteFile {
+	string name;
+	uint64_t size;
+	int64_t mtime;
+};
 
-// Download file from server
-void download_file(int sockfd, const string &filename, int timeout_seconds);
\ No newline at end of file
+// A range of a download fetched over a session of its own. The thread that owns the socket
+// routes its frames to the inbox, a pool thread receives them
+struct DownloadPart {
+	ByteRange range;
+	uint16_t session_id;
+	Inbox inbox;
+	uint64_t in_order;	// bytes of the range on disk with nothing missing before them
+	bool received;
+	bool written;
+};
+
+// Request files available for download in server and print them,
+// session options start as what this host supports and end as what the server agreed on
+vector<RemoteFile> list_files(Session &session);
+
+// Download file from server. When the server serves ranges, a large file is split in parts
+// fetched over up to sessions sessions at once, and an interrupted download leaves a journal
+// next to the file so the next one only asks for what is missing
+void download_file(Session &session, const RemoteFile &remote, int sessions);
+
+// Play file as it arrives: bytes go to output (a pipe, a terminal) in order as soon as they
+// are contiguous, at most STREAM_BUFFER_FRAMES frames wait for the reader. Closes output
+void stream_file(Session &session, const RemoteFile &remote, int output);
\ No newline at end of file
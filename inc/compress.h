@@ -0,0 +1,62 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "config.h"
+
+using namespace std;
+
+// Byte oriented LZ77 in the style of LZ4: sequences of [token][literal length][literals]
+// [offset, 2 bytes little endian][match length], the token holding 4 bits of each length and
+// 255 bytes extending them. The last sequence only has literals. Fast rather than small.
+//
+// A compressed transfer sends the file as blocks of up to COMPRESS_BLOCK_BYTES, each
+// [raw length u32][stored length u32] big endian and then the stored bytes. A block that
+// doesn't shrink is stored as it is, stored length is then the raw length. The blocks run
+// on from frame to frame, every frame full but the last
+#define COMPRESS_BLOCK_HEADER 8
+
+// Largest lz_compress output for size bytes
+size_t lz_bound(size_t size);
+
+// Compresses size bytes into out, at most capacity bytes of it. Returns the compressed size,
+// 0 when it would take more than capacity
+size_t lz_compress(const uint8_t *in, size_t size, uint8_t *out, size_t capacity);
+
+// Decompresses exactly raw_size bytes into out, false if in is damaged
+bool lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t raw_size);
+
+// Writes size bytes (at most COMPRESS_BLOCK_BYTES) to out as a block, out holds
+// COMPRESS_BLOCK_HEADER + size bytes. Returns the block size
+size_t compress_block(const uint8_t *in, size_t size, uint8_t *out);
+
+// How much of its size what is at data shrinks to, from COMPRESS_SAMPLE_BYTES at each of
+// four places spread over it
+double compress_sample(const uint8_t *data, size_t size);
+
+// Receiver side of a compressed transfer, fed the payloads in sequence order
+struct BlockDecoder {
+	vector<uint8_t> block;	// header and stored bytes of the block being received
+	size_t filled;
+	size_t stored;	// once the header is in
+	vector<uint8_t> raw;
+	uint64_t decoded;  // raw bytes handed out so far
+	bool damaged;
+};
+
+void block_decoder_init(BlockDecoder &decoder);
+
+// Takes the next size bytes of the transfer, handing every block they complete to output,
+// while decoded is still where the block starts. false once the data is damaged, what
+// comes after that is ignored
+bool block_decoder_feed(BlockDecoder &decoder, const uint8_t *data, size_t size,
+						const function<void(const uint8_t *, size_t)> &output);
+
+// Nothing is left of a block cut short
+bool block_decoder_done(const BlockDecoder &decoder);
+
+#endif
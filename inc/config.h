@@ -5,20 +5,77 @@
 #define SHOW_LOGS 1
 
 /*FRAME CONFIGS*/
-#define WINDOW_SIZE 5
-#define FRAME_DATA_SIZE 63
-#define MAX_SEQ 32
+#define WINDOW_SIZE 5	 // initial window, adapted at runtime
+#define WINDOW_MIN 1
+#define WINDOW_MAX 1024	 // selective repeat needs WINDOW_MAX <= MAX_SEQ / 2
+#define FRAME_DATA_SIZE 63		   // legacy frame payload
+#define MAX_FRAME_DATA_SIZE 9000  // large frame payload, jumbo frames when the MTU allows
+#define MAX_SEQ 65536
+#define USE_SACK 1  // acknowledge large format transfers with SACKs
+#define SACK_EVERY_FRAMES 8  // frames a receiver lets pass before it sends a SACK
+#define SACK_DELAY_US 1000	  // longest a received frame waits to be covered by a SACK
+#define USE_CRC32C 1  // offer CRC-32C instead of the 8 bit crc to large format peers
+#define USE_FEC 1	  // offer parity frames to peers that use SACKs
+#define FEC_GROUP_FRAMES 32	 // data frames covered by one round of parity frames
+#define FEC_MAX_PARITY 8	 // most parity frames per group, on the lossiest links
+#define FEC_MIN_LOSS 0.002	 // loss rate under which no parity is sent
+#define USE_PACKED_LIST 1  // send listings as packed entries through the transfer window
+#define USE_RANGES 1  // download byte ranges, so interrupted downloads can be resumed
+#define USE_COMPRESSION 1  // compress listings and files that shrink, for peers that can take it
 
 /*ERRORS CONFIGS*/
 #define TEST_ERRORS 0
 #define ERRORS_FREQ_DOWNLOAD 100
 #define ERRORS_FREQ_LIST 2
-#define FIX_BUGGED_WINDOWS 1
 
 /*SOCKET CONFIGS*/
+#define PROTOCOL_ETHERTYPE 0x88B5  // IEEE local experimental EtherType
+#define PROMISCUOUS 0			   // only needed when peers send to other MACs
 #define INTERFACE_NAME "wlp2s0"
 // #define INTERFACE_NAME "enp1s0"
-#define TIMEOUT_SECONDS 10
+#define TIMEOUT_SECONDS 10  // silence after which the peer is given up on
+#define SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+#define RX_BUFFER_SIZE 65536  // recv() fallback, fits any frame
+#define TX_BATCH_SIZE 1024	  // frames per sendmmsg, at most UIO_MAXIOV
 #define MAX_RETIES 5
+#define TRANSPORT_MAX_FDS 4096	// highest descriptor a transport endpoint may get
+
+/*RECEIVE RING CONFIGS*/
+#define USE_RX_RING 1
+#define RX_RING_BLOCK_SIZE (1 << 20)
+#define RX_RING_BLOCKS 8
+#define RX_RING_FRAME_SIZE 16384
+#define RX_RING_RETIRE_MS 1
+
+/*RETRANSMISSION TIMER CONFIGS*/
+#define RTO_INITIAL_US 200000  // before the first round trip was measured
+#define RTO_MIN_US 10000
+#define RTO_MAX_US 2000000
+
+/*SERVER CONFIGS*/
+#define WORKER_THREADS 0  // transfers served in parallel, 0 for one per core
+#define INBOX_SIZE 4096	  // frames queued for a session before new ones are dropped
+#define READAHEAD_BYTES (8 * 1024 * 1024)  // how far ahead of the window the file is read
+#define PREFETCH_FRAMES 4096  // frames framed and checksummed ahead of the transmit loop
+#define STREAM_AHEAD_FRAMES 256	 // most frames a stream has in flight past the playhead
+#define CATALOG_HASH 0  // hash files for the catalog, read whole once each time they change
+#define COMPRESS_BLOCK_BYTES 65536	 // file bytes compressed together
+#define COMPRESS_SAMPLE_BYTES 16384	 // read from four places of a file to see if it shrinks
+#define COMPRESS_MAX_RATIO 0.9		 // files whose samples don't shrink below this go as they are
+#define FRAME_CACHE_BYTES (256 * 1024 * 1024)  // popular files kept framed in memory, 0 for none
+#define FRAME_CACHE_WARM_LIST "./warm.list"	   // read into the cache at startup, a name a line
+
+/*METRICS CONFIGS*/
+#define METRICS_SOCKET "./server.sock"	 // answers every connection with a stats line
+#define METRICS_INTERVAL_SECONDS 0		 // the server prints a stats line this often, 0 never
+#define TRACE_RING_EVENTS 65536			 // latest protocol events kept, a power of two
+#define TRACE_DUMP_FILE "./trace.log"	 // where SIGUSR1 makes the server dump them
+
+/*CLIENT CONFIGS*/
+#define STREAM_BUFFER_FRAMES 256  // playout buffer between the network and a slow player
+#define WRITER_SLOTS 4096  // received payloads that may wait for the disk
+#define JOURNAL_SUFFIX ".journal"  // next to a partial download, what of it is on disk
+#define DOWNLOAD_SESSIONS 1  // sessions a download is split over, --parallel overrides it
+#define MIN_PART_BYTES (4 * 1024 * 1024)  // smallest part of a file worth a session of its own
 
 #endif
\ No newline at end of file
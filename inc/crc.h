@@ -0,0 +1,34 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config.h"
+
+// Checksums of the protocol. Both run over any number of bytes and continue from the crc
+// of what came before them, 0 for a fresh one. The fastest kernel the CPU supports is picked
+// at startup: slicing-by-8 tables everywhere, the SSE4.2 crc32 instruction for CRC-32C and,
+// with PCLMULQDQ, three of those interleaved and folded back together.
+
+// Byte at a time table of the 8 bit crc (polynomial 0x31), the reference for the others
+extern const uint8_t crc8_table[256];
+
+// 8 bit crc every frame format but FORMAT_LARGE_CRC32C carries
+uint8_t crc8(uint8_t crc, const uint8_t *data, size_t size);
+
+// CRC-32C (Castagnoli), for frames too long for 8 bits to protect them
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t size);
+
+// A crc continued over data of its own when only that data's crc from 0 is known, as for
+// payloads checksummed once and sent under many headers. zeros is what the data's length
+// multiplies a crc by, from crc8_zeros and crc32c_zeros
+uint8_t crc8_zeros(size_t size);
+uint8_t crc8_combine(uint8_t crc, uint8_t data_crc, uint8_t zeros);
+uint32_t crc32c_zeros(size_t size);
+uint32_t crc32c_combine(uint32_t crc, uint32_t data_crc, uint32_t zeros);
+
+// Name of the CRC-32C kernel in use
+const char *crc32c_kernel();
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <cstdint>
+#include <vector>
+
+#include "frame.h"
+#include "config.h"
+
+using namespace std;
+
+// Forward error correction. After every FEC_GROUP_FRAMES data frames the sender adds k
+// TYPE_PARITY frames, parity j being the XOR of the group frames whose index is j modulo k.
+// A receiver missing one frame of a class rebuilds it from the parity and the rest of the
+// class, so a burst of up to k lost frames costs no round trip. k follows the loss rate.
+//
+// A parity frame has the sequence of the first frame of its group and its payload starts
+// with [index j][count k][frames in group][XOR of the class lengths, 2 bytes]
+#define FEC_HEADER_SIZE 5
+#define FEC_HISTORY 128	 // data frames a receiver keeps to rebuild from, a power of two
+#define FEC_PARITY_POOL (4 * FEC_MAX_PARITY)
+
+// Sender side of a transfer
+struct FecEncoder {
+	uint16_t payload_size;
+	int parity_count;  // k of the current group, 0 sends none
+	int group_size;	   // data frames in the current group so far
+	uint16_t group_start;
+	uint16_t session;
+	// parities being built and then queued, reused in turn so a queued one stays put until
+	// the batch is flushed. Payloads are FEC_PARITY_POOL slots of parity_size bytes
+	vector<FrameHeader> parity;
+	vector<uint8_t> parity_payloads;
+	vector<uint16_t> length_xor;
+	int first_parity;  // where the current group's parities start in the pool
+	double loss_rate;  // smoothed fraction of data frames lost, rebuilt ones included
+	int sent;		   // data frames sent since the group started
+	int lost;		   // and lost in that time
+};
+
+// Receiver side of a transfer
+struct FecDecoder {
+	uint16_t payload_size;
+	vector<uint8_t> payloads;  // FEC_HISTORY slots of payload_size bytes
+	vector<int32_t> sequences;	// sequence each slot holds, -1 when empty
+	vector<uint16_t> lengths;
+	vector<uint8_t> rebuilt;  // a frame with room for payload_size bytes, used as a Frame
+};
+
+void fec_encoder_init(FecEncoder &fec, uint16_t payload_size);
+
+// Adds a data frame sent for the first time to the current group, queueing the parity
+// of the group into batch once it is full
+void fec_add(FecEncoder &fec, TxBatch &batch, const FrameHeader &header, const uint8_t *payload,
+			 FrameFormat format);
+
+// Queues the parity of a group cut short by the end of the file
+void fec_finish(FecEncoder &fec, TxBatch &batch, FrameFormat format);
+
+// Data frames that had to be resent or that the receiver rebuilt
+void fec_on_loss(FecEncoder &fec, int frames);
+
+void fec_decoder_init(FecDecoder &fec, uint16_t payload_size);
+
+// Keeps an intact data frame around to rebuild the others of its class
+void fec_remember(FecDecoder &fec, const Frame &data);
+
+// The frame parity rebuilds, nullptr when its class lost none or more than one.
+// Valid until the next call
+const Frame *fec_recover(FecDecoder &fec, const Frame &parity);
+
+#endif
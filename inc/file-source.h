@@ -0,0 +1,35 @@
+#ifndef FILE_SOURCE_H
+#define FILE_SOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "config.h"
+
+using namespace std;
+
+// A file being served, or the range of it that was asked for, mapped read only. Frames point
+// straight into the mapping, so nothing is copied to send or to retransmit
+struct FileSource {
+	int fd;	 // -1 when the data is already in memory
+	const uint8_t *data;  // first byte served
+	size_t size;		  // bytes served
+	size_t prefetched;	  // readahead was asked for up to here, from data
+	void *mapping;		  // starts at the page holding data
+	size_t mapped_size;
+};
+
+// Maps length bytes of the file from offset on (0 for all of it) for sequential reading,
+// false if it can't be opened or is shorter than offset
+bool file_source_open(FileSource &source, const string &path, uint64_t offset, uint64_t length);
+
+// Serves size bytes of memory owned by the caller as if they were a file
+void file_source_memory(FileSource &source, const uint8_t *data, size_t size);
+
+// Asks the kernel to read ahead so at least READAHEAD_BYTES past offset are on their way
+void file_source_prefetch(FileSource &source, size_t offset);
+
+void file_source_close(FileSource &source);
+
+#endif
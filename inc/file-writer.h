@@ -0,0 +1,58 @@
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rtt.h"
+#include "spsc-ring.h"
+#include "config.h"
+
+using namespace std;
+
+// A payload waiting to be written, in a buffer owned by its ring slot
+struct WriteJob {
+	uint64_t offset;
+	uint16_t length;
+	uint8_t *data;
+};
+
+// Output file of a download. The receive loop copies payloads into ring slots and goes on,
+// a thread of its own writes them at their offset, so frames can be placed in any order
+// and a slow disk never holds back acks unless the whole ring is pending
+struct FileWriter {
+	int fd;
+	vector<uint8_t> buffers;  // one chunk per ring slot
+	SpscRing<WriteJob> jobs;
+	uint64_t end;  // largest offset written, the final file size
+	int ready_fd;  // wakes the writer thread
+	int space_fd;  // wakes the receive loop when it had to wait for a slot
+	atomic<bool> writer_waiting;
+	atomic<bool> receiver_waiting;
+	atomic<bool> closing;
+	atomic<bool> failed;
+	bool sequential;		// a stream, written in queue order
+	int64_t first_write_us;	// when the first data was queued, 0 before
+	thread writer;
+};
+
+// Creates path and reserves size bytes for it when the size is known (not 0). With keep an
+// existing file is written into instead of emptied and is never trimmed below size, so an
+// interrupted download can be finished and several writers can each fill a part of the file
+bool file_writer_open(FileWriter &writer, const string &path, uint64_t size, uint16_t chunk_size,
+					  bool keep);
+
+// Writes to fd in the order data is queued, offsets are ignored, for pipes and terminals.
+// At most slots chunks wait for the reader, fd is closed with the writer
+void file_writer_stream(FileWriter &writer, int fd, uint16_t chunk_size, size_t slots);
+
+// Queues length bytes (at most chunk_size) to be written at offset
+void file_writer_write(FileWriter &writer, uint64_t offset, const uint8_t *data, uint16_t length);
+
+// Waits for every queued write and trims a file to what was written, false if a write failed
+bool file_writer_close(FileWriter &writer);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "frame.h"
+#include "config.h"
+
+using namespace std;
+
+// A file the way a transfer sends it: its bytes, or the compressed stream of them, cut in
+// payload_size frames whose payloads are already checksummed
+struct CachedFile {
+	string name;
+	uint16_t payload_size;
+	bool compressed;
+	bool compressible;	 // samples of the file shrink, the whole file goes compressed when asked
+	uint64_t file_size;	 // of the file on disk when it was read
+	int64_t mtime_ns;
+	vector<uint8_t> bytes;
+	vector<PayloadCrc> frames;	// frame i carries the bytes from i * payload_size on
+	size_t memory;				// bytes it takes, what the cache capacity counts
+};
+
+// Position of the clock, empty once its entry is evicted or found stale
+struct CacheSlot {
+	shared_ptr<const CachedFile> file;
+	bool referenced;  // hit since the hand last passed
+};
+
+// A file to read in, by the filler thread
+struct CacheFill {
+	string name;
+	uint16_t payload_size;
+	bool compressed;
+	bool warm;	// from the warm list: always admitted, compressed when samples of it shrink
+};
+
+// Files asked for often, kept framed and checksummed in memory and sent from there by every
+// session. Eviction is CLOCK: a hit sets the referenced bit of a slot, the hand clears the bits
+// it passes and evicts the first entry it finds clear. Admission is TinyLFU: a count-min sketch
+// estimates how often each file was asked for lately, and a file only goes in if it was asked
+// for more often than every entry it would push out, so one large download can't flush the
+// cache. Entries are read in by a thread of their own, never by the transfers
+struct FrameCache {
+	string directory;
+	size_t capacity;  // bytes, 0 turns the cache off
+	mutex lock;
+	vector<CacheSlot> slots;
+	size_t hand;
+	size_t used;
+	unordered_map<string, size_t> index;  // entry key to slot
+	vector<uint8_t> sketch;				  // 4 bit counters, CACHE_SKETCH_ROWS rows
+	uint64_t sketch_additions;			  // since the counters were last halved
+	deque<CacheFill> fills;
+	unordered_set<string> pending;	// keys of the fills queued or being read
+	condition_variable wake;
+	bool closing;
+	thread filler;
+};
+
+// An empty cache for the files of directory, holding up to capacity bytes
+void frame_cache_open(FrameCache &cache, const string &directory, size_t capacity);
+
+// Queues the files named in list_path, one per line, to be read in for payload_size frames.
+// A missing list is not an error
+void frame_cache_warm(FrameCache &cache, const string &list_path, uint16_t payload_size);
+
+// The entry for a transfer of name with these frames, nullptr on a miss. Counts the request
+// towards the popularity of the file, a miss on a file asked for often queues it to be read in
+shared_ptr<const CachedFile> frame_cache_find(FrameCache &cache, const string &name,
+											  uint16_t payload_size, bool compressed);
+
+// Whether samples of name shrink, as the entry for a transfer with these frames found when it
+// read the file in. False when no entry is there or the file changed since. Doesn't count as a
+// request
+bool frame_cache_compressible(FrameCache &cache, const string &name, uint16_t payload_size,
+							  bool &compressible);
+
+// Stops the filler and frees every entry not in use
+void frame_cache_close(FrameCache &cache);
+
+#endif
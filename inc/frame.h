@@ -8,12 +8,15 @@
 #include <net/if.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <random>
 #include <fstream> 
 #include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <iomanip>
@@ -22,8 +25,9 @@
 #include <queue>
 #include <vector>
 
+#include "crc.h"
 #include "frame.h"
-#include "raw-socket.h"
+#include "transport.h"
 #include "config.h"
 
 using namespace std;
@@ -31,69 +35,182 @@ using namespace std;
 #define START_MARKER 0x7E		   // 01111110
 #define TYPE_ACK 0x00			   // 00000
 #define TYPE_NACK 0x01			   // 00001
+#define TYPE_SACK 0x02			   // 00010
 #define TYPE_LIST 0x0A			   // 01010
 #define TYPE_DOWNLOAD 0x0B		   // 01011
 #define TYPE_SHOWS_ON_SCREEN 0x10  // 10000
 #define TYPE_FILE_DESCRIPTOR 0x11  // 10001
 #define TYPE_DATA 0x12			   // 10010
+#define TYPE_PARITY 0x13		   // 10011
 #define TYPE_END_TX 0x1E		   // 11110
 #define TYPE_ERROR 0x1F			   // 11111
 
-const uint8_t crc8_table[256] = {
-    0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA, 0x7D, 0x4C, 0x1F, 0x2E,
-    0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4, 0xFA, 0xCB, 0x98, 0xA9, 0x3E, 0x0F, 0x5C, 0x6D,
-    0x86, 0xB7, 0xE4, 0xD5, 0x42, 0x73, 0x20, 0x11, 0x3F, 0x0E, 0x5D, 0x6C, 0xFB, 0xCA, 0x99, 0xA8,
-    0xC5, 0xF4, 0xA7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F, 0xB8, 0x89, 0xDA, 0xEB,
-    0x3D, 0x0C, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA, 0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13,
-    0x7E, 0x4F, 0x1C, 0x2D, 0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6, 0xA5, 0x94, 0x03, 0x32, 0x61, 0x50,
-    0xBB, 0x8A, 0xD9, 0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 0x02, 0x33, 0x60, 0x51, 0xC6, 0xF7, 0xA4, 0x95,
-    0xF8, 0xC9, 0x9A, 0xAB, 0x3C, 0x0D, 0x5E, 0x6F, 0x41, 0x70, 0x23, 0x12, 0x85, 0xB4, 0xE7, 0xD6,
-    0x7A, 0x4B, 0x18, 0x29, 0xBE, 0x8F, 0xDC, 0xED, 0xC3, 0xF2, 0xA1, 0x90, 0x07, 0x36, 0x65, 0x54,
-    0x39, 0x08, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80, 0xB1, 0xE2, 0xD3, 0x44, 0x75, 0x26, 0x17,
-    0xFC, 0xCD, 0x9E, 0xAF, 0x38, 0x09, 0x5A, 0x6B, 0x45, 0x74, 0x27, 0x16, 0x81, 0xB0, 0xE3, 0xD2,
-    0xBF, 0x8E, 0xDD, 0xEC, 0x7B, 0x4A, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xC2, 0xF3, 0xA0, 0x91,
-    0x47, 0x76, 0x25, 0x14, 0x83, 0xB2, 0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD, 0x3A, 0x0B, 0x58, 0x69,
-    0x04, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93, 0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A,
-    0xC1, 0xF0, 0xA3, 0x92, 0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF,
-    0x82, 0xB3, 0xE0, 0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0x0A, 0x59, 0x68, 0xFF, 0xCE, 0x9D, 0xAC
-};
+// Wire formats, LEGACY carries at most FRAME_DATA_SIZE bytes and is what peers speak until they
+// agree on another. LARGE_CRC32C is LARGE with a CRC-32C after the payload instead of the crc8
+enum FrameFormat { FORMAT_LEGACY, FORMAT_LARGE, FORMAT_LARGE_CRC32C };
 
+// Frame as handled by the protocol code, independent of the wire format it came in
 struct Frame {
 	uint8_t start_marker;
-	uint8_t length : 6;
-	uint8_t sequence : 5;
-	uint8_t type : 5;
-	uint8_t data[63];
+	uint8_t type;
+	uint16_t session;  // transfer the frame belongs to, 0 in legacy frames
+	uint16_t sequence;
+	uint16_t length;
+	uint8_t crc;
+	uint8_t data[MAX_FRAME_DATA_SIZE];
+};
+
+// Header of a frame whose payload is kept elsewhere, same layout as the start of Frame
+struct FrameHeader {
+	uint8_t start_marker;
+	uint8_t type;
+	uint16_t session;
+	uint16_t sequence;
+	uint16_t length;
 	uint8_t crc;
 };
 
+// Checksums of a payload on its own, worked out once for payloads sent many times, so the crc of
+// a frame carrying one only has to cover the header. The zeros are what its length shifts a crc
+// by, see crc8_combine
+struct PayloadCrc {
+	uint32_t crc32c;
+	uint32_t crc32c_zeros;
+	uint16_t length;
+	uint8_t crc8;
+	uint8_t crc8_zeros;
+};
+
+// Wire formats are written and read byte by byte, multi byte fields in a fixed order, so they
+// don't depend on the compiler or the host.
+
+// Legacy wire layout, the small frame used before the large format is agreed on and with peers
+// that offer no options: marker, 6 bit length, little endian sequence, 5 bit type, a 63 byte
+// payload zero filled past length, a crc8 of everything before it, and one byte of padding.
+// Every format travels under PROTOCOL_ETHERTYPE. The first builds of this protocol sent their
+// frames raw under ETH_P_ALL, with no ethernet header of their own, and can't talk to this one
+#define LEGACY_LENGTH_OFFSET 1
+#define LEGACY_LENGTH_MASK 0x3F
+#define LEGACY_SEQUENCE_OFFSET 2
+#define LEGACY_TYPE_OFFSET 4
+#define LEGACY_TYPE_MASK 0x1F
+#define LEGACY_DATA_OFFSET 5
+#define LEGACY_CRC_OFFSET (LEGACY_DATA_OFFSET + FRAME_DATA_SIZE)
+#define LEGACY_FRAME_SIZE (LEGACY_CRC_OFFSET + 2)
+
+// Large wire layout: a 9 byte header with little endian fields, followed by only length payload
+// bytes. The type byte has LARGE_FRAME_TAG set, a legacy length byte never does.
+// CRC32C_FRAME_TAG marks a big endian CRC-32C over header and payload right after the payload,
+// the crc byte is then 0
+#define WIRE_TYPE_OFFSET 1
+#define WIRE_SESSION_OFFSET 2
+#define WIRE_SEQUENCE_OFFSET 4
+#define WIRE_LENGTH_OFFSET 6
+#define WIRE_CRC_OFFSET 8
+#define LARGE_HEADER_SIZE 9
+#define LARGE_FRAME_TAG 0xC0
+#define CRC32C_FRAME_TAG 0x20
+#define CRC32C_SIZE 4
+#define MAX_WIRE_FRAME_SIZE (LARGE_HEADER_SIZE + MAX_FRAME_DATA_SIZE + CRC32C_SIZE)
+#define FRAME_IOVECS 3	// header, payload, CRC-32C
+#define MAX_WIRE_HEADER_SIZE LEGACY_FRAME_SIZE	// a legacy frame is all header
+
+// Received frames have their checksum checked once, whatever the wire format, and the
+// verdict left in crc
+#define CRC_INTACT 0x00
+#define CRC_CORRUPT 0xFF
+
+static_assert(offsetof(FrameHeader, crc) == offsetof(Frame, crc), "FrameHeader must match Frame");
+// a large frame is decoded where it was received, its fields only get their byte order fixed
+static_assert(offsetof(Frame, type) == WIRE_TYPE_OFFSET &&
+				  offsetof(Frame, session) == WIRE_SESSION_OFFSET &&
+				  offsetof(Frame, sequence) == WIRE_SEQUENCE_OFFSET &&
+				  offsetof(Frame, length) == WIRE_LENGTH_OFFSET &&
+				  offsetof(Frame, crc) == WIRE_CRC_OFFSET &&
+				  offsetof(Frame, data) == LARGE_HEADER_SIZE,
+			  "Frame must overlay the large wire header");
+
+#define CONTROL_DATA_SIZE 256  // payload room of acks with their options, NACKs, SACKs and errors
+
+// Room for a frame with a small payload, without the MAX_FRAME_DATA_SIZE bytes a Frame reserves.
+// Used as a Frame through control_frame, the way a received frame is used where it landed
+struct ControlFrame {
+	alignas(Frame) uint8_t bytes[LARGE_HEADER_SIZE + CONTROL_DATA_SIZE];
+};
+static_assert(FRAME_DATA_SIZE <= CONTROL_DATA_SIZE, "a legacy frame must fit a ControlFrame");
+
+// Frames waiting to go out in one sendmmsg call. Payloads are referenced, not copied,
+// so a queued frame must not change until the batch is flushed.
+struct TxBatch {
+	int sockfd;
+	unsigned int count;
+	vector<uint8_t> headers;
+	vector<struct iovec> iovecs;
+	vector<struct mmsghdr> messages;
+};
+
 
 /*HELPERS*/
 string translate_frame_type(uint8_t type);
 
 uint8_t calculate_crc(const Frame &frame);
 
+// whether a received frame arrived as it was sent
+bool frame_intact(const Frame &frame);
+
+// crc of a frame whose payload is not in the same buffer
+uint8_t calculate_crc(const FrameHeader &header, const uint8_t *payload);
+
+// same, from the checksums of the payload
+uint8_t calculate_crc(const FrameHeader &header, const PayloadCrc &payload);
+
+// checksums of length payload bytes, the zeros taken from previous when it is as long
+PayloadCrc payload_crc(const uint8_t *payload, uint16_t length, const PayloadCrc *previous);
+
+// header fields of frame
+FrameHeader frame_header(const Frame &frame);
+
+// how far sequence is ahead of base in the circular sequence space
+int seq_offset(uint16_t base, uint16_t sequence);
+
+
+/*WIRE FORMAT*/
+
+// encode frame in the given wire format and send it
+void send_frame(int sockfd, const Frame &frame, FrameFormat format);
+
+// prepare an empty batch for the socket
+void tx_batch_init(TxBatch &batch, int sockfd);
+
+// encode frame into the batch, flushing first if it is full
+void queue_frame(TxBatch &batch, const Frame &frame, FrameFormat format);
 
-/*FUNCTIONS TO SEND DATA*/
+// same, with the payload taken from wherever it lives (a file mapping), without copying it
+void queue_frame(TxBatch &batch, const FrameHeader &header, const uint8_t *payload,
+				 FrameFormat format);
 
-// send data frame until gets ack
-void send_frame_and_receive_ack(int sockfd, Frame &frame, int timeout_seconds);
+// same, with the checksums of the payload already known, nullptr when they aren't
+void queue_frame(TxBatch &batch, const FrameHeader &header, const uint8_t *payload,
+				 const PayloadCrc *checksums, FrameFormat format);
 
-// receive response frame
-bool receive_frame_with_timeout(int sockfd, Frame &frame, int timeout_seconds);
+// send every queued frame with as few syscalls as possible
+void flush_frames(TxBatch &batch);
 
-// ===================================================
-// ===================================================
+// receive one protocol frame in any wire format, false on timeout or foreign traffic.
+// Its checksum is already checked, see frame_intact. timeout_us may be SOCKET_TIMEOUT
+bool receive_frame(int sockfd, Frame &frame, int64_t timeout_us);
 
-/*FUNCTIONS TO RECEIVE DATA*/
+// same as receive_frame but without copying: the frame is decoded where it was received and
+// stays valid until the next receive on the socket. nullptr on timeout or foreign traffic
+const Frame *receive_frame_view(int sockfd, int64_t timeout_us);
 
-// receive data, send nack until right
-void receive_frame_and_send_ack(int sockfd, uint8_t seq, Frame &frame);
+// copy header and payload only, not the unused part of data
+void copy_frame(Frame &destination, const Frame &source);
 
-// send ack for frame sequence
-void send_ack(int sockfd, uint8_t sequence);
+// the frame held by control, its payload must stay within CONTROL_DATA_SIZE
+Frame &control_frame(ControlFrame &control);
 
-// send nack for frame sequence
-void send_nack(int sockfd, uint8_t sequence);
+// largest payload a frame may carry on an interface with the given MTU
+uint16_t max_payload_for_mtu(int mtu);
 
 #endif
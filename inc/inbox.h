@@ -0,0 +1,39 @@
+#ifndef INBOX_H
+#define INBOX_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "frame.h"
+#include "config.h"
+
+using namespace std;
+
+// Frames the server dispatcher routed to one session. The dispatcher pushes, the worker
+// serving the session pops, and an eventfd tells the worker's reactor there is something new
+struct Inbox {
+	mutex lock;
+	deque<vector<uint8_t>> frames;	// header and payload bytes of each frame
+	int event_fd;
+	atomic<bool> closed;  // the session is over or was replaced, nothing more is accepted
+	Frame popped;		  // last frame handed out
+};
+
+void inbox_init(Inbox &inbox);
+
+// Queues a copy of frame, dropped like on a full socket when INBOX_SIZE frames are waiting
+void inbox_push(Inbox &inbox, const Frame &frame);
+
+// Next queued frame, valid until the next pop. nullptr when empty, which also rearms the eventfd
+const Frame *inbox_pop(Inbox &inbox);
+
+// Refuses further frames and wakes the consumer so it notices
+void inbox_shutdown(Inbox &inbox);
+
+// Shuts the inbox down and releases the eventfd
+void inbox_close(Inbox &inbox);
+
+#endif
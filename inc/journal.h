@@ -0,0 +1,41 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "options.h"
+#include "config.h"
+
+using namespace std;
+
+// What of a download is already on disk, kept next to it in <name>JOURNAL_SUFFIX so an
+// interrupted download goes on where it stopped. It holds for one version of the remote
+// file, told apart by its size and mtime
+struct Journal {
+	string path;
+	uint64_t size;
+	int64_t mtime;	// 0 when the server didn't tell, the size alone has to match then
+	vector<ByteRange> done;	 // sorted, never overlapping or touching
+};
+
+void journal_init(Journal &journal, const string &filename, uint64_t size, int64_t mtime);
+
+// Reads what an earlier attempt left, false if it left nothing for this version of the file
+bool journal_load(Journal &journal);
+
+// Marks length bytes from offset on as written
+void journal_add(Journal &journal, uint64_t offset, uint64_t length);
+
+// Ranges still to download, in order
+vector<ByteRange> journal_missing(const Journal &journal);
+
+uint64_t journal_done_bytes(const Journal &journal);
+
+// Replaces the journal on disk as a whole, false if it couldn't be written
+bool journal_save(const Journal &journal);
+
+void journal_remove(const Journal &journal);
+
+#endif
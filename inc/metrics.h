@@ -0,0 +1,105 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "reactor.h"
+#include "config.h"
+
+using namespace std;
+
+#define METRIC_BUCKETS 32  // histogram buckets, powers of two
+
+// Bucket i counts the values in [2^(i-1), 2^i), 0 goes to bucket 0
+struct Histogram {
+	atomic<uint64_t> buckets[METRIC_BUCKETS];
+};
+
+// What one session did. Only the thread running the session writes it, with relaxed atomics so
+// that a reader can add it up while the session runs
+struct Metrics {
+	atomic<uint64_t> frames_sent;  // data and control frames, parity not included
+	atomic<uint64_t> frames_received;
+	atomic<uint64_t> retransmits;
+	atomic<uint64_t> nacks;	 // frames reported missing, by NACK or SACK
+	atomic<uint64_t> timeouts;
+	atomic<uint64_t> crc_failures;
+	atomic<uint64_t> duplicates;
+	atomic<uint64_t> rebuilt;	// from parity
+	Histogram rtt_us;			// round trips measured
+	Histogram window_frames;	// frames in flight each time the window was filled
+};
+
+// What the frame cache of the process holds and did, written by it with relaxed atomics
+struct CacheMetrics {
+	atomic<uint64_t> capacity;	// bytes, 0 without a cache
+	atomic<uint64_t> bytes;
+	atomic<uint64_t> files;
+	atomic<uint64_t> hits;
+	atomic<uint64_t> misses;
+	atomic<uint64_t> evictions;
+};
+
+extern CacheMetrics cache_metrics;
+
+// Plain copy of the metrics of every session, running and ended
+struct MetricsSnapshot {
+	uint64_t sessions;	// running
+	uint64_t sessions_ended;
+	uint64_t frames_sent;
+	uint64_t frames_received;
+	uint64_t retransmits;
+	uint64_t nacks;
+	uint64_t timeouts;
+	uint64_t crc_failures;
+	uint64_t duplicates;
+	uint64_t rebuilt;
+	uint64_t rtt_us[METRIC_BUCKETS];
+	uint64_t window_frames[METRIC_BUCKETS];
+	uint64_t cache_capacity;
+	uint64_t cache_bytes;
+	uint64_t cache_files;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t cache_evictions;
+};
+
+// Thread answering stats queries, see metrics_serve
+struct MetricsServer {
+	thread worker;
+	int stop_fd;
+	string socket_path;
+};
+
+inline void metric_add(atomic<uint64_t> &counter, uint64_t count = 1) {
+	counter.fetch_add(count, memory_order_relaxed);
+}
+
+void histogram_add(Histogram &histogram, uint64_t value);
+
+// Upper bound of the bucket holding the value at fraction of the counts, 0 without any
+uint64_t histogram_percentile(const uint64_t buckets[METRIC_BUCKETS], double fraction);
+
+// Zeroed metrics of a new session, counted in snapshots until closed
+Metrics *metrics_open();
+
+// Adds the metrics of an ended session to the totals and frees them
+void metrics_close(Metrics *metrics);
+
+MetricsSnapshot metrics_snapshot();
+
+// One line of key=value pairs, the cache ones only when there is a cache
+string metrics_format(const MetricsSnapshot &snapshot);
+
+// From a thread of its own: answers every connection to the Unix socket at socket_path with a
+// stats line, dumps the trace ring to TRACE_DUMP_FILE on SIGUSR1 and prints a stats line every
+// METRICS_INTERVAL_SECONDS. Blocks SIGUSR1 in the calling thread, so call it before starting
+// other threads
+void metrics_serve(MetricsServer &server, const string &socket_path);
+
+void metrics_stop(MetricsServer &server);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstdint>
+#include <string>
+
+#include "frame.h"
+#include "config.h"
+
+using namespace std;
+
+// Options are appended to LIST/DOWNLOAD requests and to the ack that answers them as
+// [type][length][value] entries. A peer that sends none stays legacy.
+#define OPTION_MAX_PAYLOAD 0x01	 // uint16, largest payload the sender can take
+#define OPTION_SESSION_ID 0x02	 // uint16, picked by the client for each request, echoed back
+#define OPTION_CHECKSUM 0x03	 // uint16, CHECKSUM_CRC32C when the sender can do FORMAT_LARGE_CRC32C
+#define OPTION_SELECTIVE_ACK 0x04  // uint16, 1 when the sender understands TYPE_SACK
+#define OPTION_FEC 0x05			   // uint16, 1 when the sender can rebuild frames from TYPE_PARITY
+#define OPTION_PACKED_LIST 0x06	   // uint16, 1 when the sender reads listings packed by the catalog
+#define OPTION_RANGES 0x07		   // uint16, 1 when the sender serves OPTION_RANGE
+#define OPTION_RANGE 0x08			   // uint64 offset, uint64 length, DOWNLOAD requests only
+#define OPTION_COMPRESSION 0x09	   // uint16, COMPRESSION_LZ when the sender can decompress
+#define OPTION_COMPRESSED 0x0A	   // uint16, 1 in an ack when the transfer comes compressed
+
+#define CHECKSUM_CRC32C 0x01
+#define COMPRESSION_LZ 0x01
+
+// What both ends agreed on for a transfer
+struct TransferOptions {
+	FrameFormat format;
+	uint16_t payload_size;	// data bytes per frame
+	uint16_t session_id;	// carried by every large frame of the transfer, 0 when legacy
+	bool selective_ack;		// data is acknowledged with SACKs instead of an ACK or NACK per event
+	bool fec;				// data is followed by parity frames, needs selective_ack
+	bool packed_list;		// LIST is answered like a download of the packed catalog
+	bool ranges;			// DOWNLOAD may ask for part of a file
+	bool compression;		// transfers may come compressed, see compress.h
+	bool compressed;		// this one does, the server decides per file and says so in its ack
+};
+
+// Part of a file, length 0 runs to its end
+struct ByteRange {
+	uint64_t offset;
+	uint64_t length;
+};
+
+// Options of a peer that never advertised any
+TransferOptions legacy_options();
+
+// Best options this host supports on an interface with the given MTU
+TransferOptions local_options(int mtu);
+
+// Options both ends support, in the session the remote picked
+TransferOptions negotiate_options(const TransferOptions &local, const TransferOptions &remote);
+
+// A fresh non zero session id
+uint16_t new_session_id();
+
+// Appends options to frame.data, updating frame.length
+void write_options(Frame &frame, const TransferOptions &options);
+
+// Reads the options found in frame.data from offset on
+TransferOptions read_options(const Frame &frame, uint16_t offset);
+
+// Filename of a DOWNLOAD request, options start after its terminating NUL
+string request_filename(const Frame &request);
+
+// Options carried by a LIST or DOWNLOAD request
+TransferOptions request_options(const Frame &request);
+
+// Appends the range to a DOWNLOAD request, after its options
+void write_range(Frame &request, const ByteRange &range);
+
+// Range a DOWNLOAD request asks for, the whole file when it names none
+ByteRange request_range(const Frame &request);
+
+// Appends the terminator and the file size to a FILE_DESCRIPTOR holding a name, large format only
+void write_file_size(Frame &descriptor, uint64_t size);
+
+// Size after the name of a FILE_DESCRIPTOR, 0 when the server didn't send one
+uint64_t read_file_size(const Frame &descriptor);
+
+#endif
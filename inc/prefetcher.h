@@ -0,0 +1,70 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "file-source.h"
+#include "frame-cache.h"
+#include "frame.h"
+#include "options.h"
+#include "spsc-ring.h"
+#include "config.h"
+
+using namespace std;
+
+// A frame ready to go out: its header with the crc already in it and where its payload is
+struct PreparedFrame {
+	FrameHeader header;
+	const uint8_t *payload;
+	const PayloadCrc *checksums;  // of the payload, nullptr unless it comes from the frame cache
+};
+
+// Part of a compressed transfer, the payloads of its frames point into bytes
+struct CompressedChunk {
+	vector<uint8_t> bytes;
+	uint64_t last_frame;  // index of the last frame cut from it
+};
+
+// Producer stage of a download. Its own thread walks the file mapping ahead of the transmit
+// loop, taking the page faults and computing the crcs, and hands finished frames over
+// through a lock free ring. A compressed transfer is compressed there as well. A file from the
+// frame cache has nothing left to do, its frames are made as they are taken and no thread runs
+struct Prefetcher {
+	FileSource *file;
+	TransferOptions options;
+	SpscRing<PreparedFrame> ring;
+	int ready_fd;  // signaled when a frame lands in an empty ring, for the transmit reactor
+	int space_fd;  // signaled when a full ring gets room, the producer sleeps on it
+	atomic<bool> producer_waiting;
+	atomic<bool> stopping;
+	deque<CompressedChunk> chunks;	// only the producer adds and frees them
+	atomic<uint64_t> released;		// frames taken that are never sent again
+	const CachedFile *cached;		// file lies in its bytes, nullptr when it doesn't
+	size_t offset;					// of the next cached frame in file
+	uint16_t sequence;
+	thread producer;
+};
+
+// Starts framing file from its first byte, sequences from 0
+void prefetcher_start(Prefetcher &prefetcher, FileSource &file, const TransferOptions &options);
+
+// Same, for a file that lies in cached, whole or a range of it. The checksums of every payload
+// the cache has go out as they are
+void prefetcher_start_cached(Prefetcher &prefetcher, FileSource &file, const CachedFile &cached,
+							 const TransferOptions &options);
+
+// Next frame in file order, false when the producer is behind. ready_fd fires once it catches up
+bool prefetcher_next(Prefetcher &prefetcher, PreparedFrame &frame);
+
+// The first frames frames taken are never sent again, none of them may be queued unsent.
+// Their compressed payloads can then be freed
+void prefetcher_release(Prefetcher &prefetcher, uint64_t frames);
+
+// Stops the producer, wherever it is, and waits for it
+void prefetcher_stop(Prefetcher &prefetcher);
+
+#endif
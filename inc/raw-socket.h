@@ -1,29 +1,78 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
 #include <cstdint>
 #include <iostream>
 
+#include "transport.h"
 #include "config.h"
 
 using namespace std;
 
+// The backend that puts frames on a network interface. Sockets created here are registered
+// as transport endpoints, protocol code only uses them through transport.h
+
 // Creates a raw socket
 int create_socket();
 
 // Gets the index of the specified network interface
 int get_interface_index(const char *interface_name);
 
+// Gets the MTU of the specified network interface
+int get_interface_mtu(const char *interface_name);
+
 // Binds the socket to the specified network interface
 void bind_socket_to_interface(int sockfd, int interface_index);
 
+// Lets only our EtherType with the frame start marker reach user space
+void attach_protocol_filter(int sockfd);
+
 // Sets the socket to promiscuous mode
 void set_socket_promiscuous(int sockfd, int interface_index);
 
+// Stops the socket from receiving copies of the frames it sends
+void set_socket_ignore_outgoing(int sockfd);
+
+// Sizes the kernel buffers so a full window fits in them
+void set_socket_buffers(int sockfd, int buffer_size);
+
 // Sets the timeout for socket operations
 void set_socket_timeout(int sockfd, int timeout_seconds);
 
+// Maps a TPACKET_V3 receive ring shared with the kernel, false if the kernel refuses it
+bool set_socket_rx_ring(int sockfd);
+
 // Creates and configures a raw socket
 int raw_socket_create(const char *interface_name, int timeout_seconds);
 
+// Creates a socket that only sends, to peer. It is never bound so it receives nothing
+int raw_socket_create_sender(const char *interface_name, const uint8_t *peer);
+
+
+// Unmaps the ring, forgets the socket state and closes the socket
+void raw_socket_close(int sockfd);
+
+// Waits for the next packet and points packet at it, straight inside the receive ring when
+// there is one. The packet stays valid until the next receive on the socket.
+// Returns its length, or -1 after timeout_us (SOCKET_TIMEOUT for the one the socket was created with,
+// 0 to only take what is already queued).
+ssize_t raw_socket_receive(int sockfd, uint8_t **packet, int64_t timeout_us);
+
+// Destination of the frames sent from now on, broadcast until this is called
+void raw_socket_set_peer(int sockfd, const uint8_t *mac);
+
+// Source address of the last packet received
+const uint8_t *raw_socket_last_source(int sockfd);
+
+// Address to put in msg_name of every message sent
+const struct sockaddr_ll *raw_socket_peer(int sockfd);
+
+// Sends count prepared messages, one sendmmsg call for as many as the kernel takes at once
+void raw_socket_send_batch(int sockfd, struct mmsghdr *messages, unsigned int count);
+
 #endif
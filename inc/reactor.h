@@ -0,0 +1,53 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "config.h"
+
+using namespace std;
+
+#define TIMER_OFF -1  // disarms a timer
+
+// Single threaded event loop over epoll: file descriptors and timerfds get a handler that runs
+// when they become readable. Protocol code installs its handlers and runs the loop until one of
+// them calls reactor_stop, instead of polling the socket itself
+struct Reactor {
+	int epoll_fd;
+	unordered_map<int, function<void()>> handlers;
+	unordered_set<int> timers;	// timerfds owned by the reactor, their counter is drained for the handler
+	bool running;
+};
+
+// Creates the epoll instance
+void reactor_init(Reactor &reactor);
+
+// Closes the epoll instance and every timer created through it
+void reactor_close(Reactor &reactor);
+
+// Calls handler whenever fd is readable, replacing any previous handler of fd.
+// Events are level triggered and a handler must not replace itself while it runs
+void reactor_watch(Reactor &reactor, int fd, function<void()> handler);
+
+// Stops calling the handler of fd
+void reactor_unwatch(Reactor &reactor, int fd);
+
+// Creates a disarmed monotonic timer, give it a handler with reactor_watch
+int reactor_create_timer(Reactor &reactor);
+
+// Unwatches and closes a timer
+void reactor_destroy_timer(Reactor &reactor, int timer);
+
+// Fires timer once after timeout_us, TIMER_OFF disarms it
+void reactor_arm_timer(int timer, int64_t timeout_us);
+
+// Dispatches events until a handler calls reactor_stop
+void reactor_run(Reactor &reactor);
+
+// Makes reactor_run return once the current handler is done
+void reactor_stop(Reactor &reactor);
+
+#endif
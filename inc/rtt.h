@@ -0,0 +1,28 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include <cstdint>
+
+#include "config.h"
+
+// Round trip estimation and retransmission timeout (Jacobson/Karels), in microseconds
+struct RttEstimator {
+	int64_t srtt;	 // smoothed round trip time
+	int64_t rttvar;	 // round trip time variation
+	int64_t rto;	 // current retransmission timeout, backed off after timeouts
+	bool has_sample;
+};
+
+// Monotonic clock in microseconds
+int64_t now_us();
+
+// Starts with RTO_INITIAL_US until the first sample arrives
+void rtt_init(RttEstimator &rtt);
+
+// Feeds a round trip measured on a frame that was never retransmitted (Karn's rule)
+void rtt_sample(RttEstimator &rtt, int64_t sample_us);
+
+// Doubles the timeout after it expired, up to RTO_MAX_US
+void rtt_backoff(RttEstimator &rtt);
+
+#endif
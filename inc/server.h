@@ -7,26 +7,76 @@
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <cstdint>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
+#include "catalog.h"
+#include "compress.h"
+#include "fec.h"
+#include "file-source.h"
+#include "frame-cache.h"
 #include "frame.h"
+#include "inbox.h"
+#include "options.h"
+#include "prefetcher.h"
 #include "raw-socket.h"
+#include "session.h"
+#include "window.h"
+#include "worker-pool.h"
 #include "config.h"
 
 using namespace std;
 
+// A request being served by a worker
+struct ServerSession {
+	Frame request;
+	TransferOptions options;
+	int sockfd;	 // sends to the client that made the request
+	Inbox inbox;
+	bool acked;	 // the worker settled the options and told the client, under the dispatcher lock
+};
+
+// Owns the server socket: frames are routed to the session they belong to by client MAC and
+// session id, and every new request becomes a job on the worker pool
+struct Dispatcher {
+	int sockfd;
+	int timeout_seconds;
+	TransferOptions local;
+	WorkerPool *pool;
+	Catalog catalog;  // what LIST answers with, shared by every session
+	FrameCache cache;  // popular files, sent from memory by every session
+	int window_limit;	   // given to every session, see Session
+	TransferStats *stats;  // downloads only, listings are not measured
+	mutex lock;	 // workers remove their own session once done
+	unordered_map<uint64_t, shared_ptr<ServerSession>> sessions;
+};
+
 // Send list of available files to client
-void handle_list_request(int sockfd, int timeout_seconds);
+void handle_list_request(Session &session, Catalog &catalog);
+
+// Send file through the transfer window, kept close to the playhead when stream. file lies in
+// the bytes of cached when it comes from the frame cache, cached is nullptr otherwise
+void send_file(Session &session, FileSource &file, const CachedFile *cached, bool stream);
+
+// Send file to client, paced for playback when asked with SHOWS_ON_SCREEN. Taken from the
+// frame cache when it has the file
+void handle_download_request(Session &session, const Frame &frame, FrameCache &cache);
+
+// Ack a request, telling the client which options were agreed on
+void acknowledge_request(int sockfd, const Frame &request, const TransferOptions &options);
 
-// Send file to client
-void handle_download_request(int sockfd, const Frame &frame, int timeout_seconds);
+void dispatcher_init(Dispatcher &dispatcher, int sockfd, int timeout_seconds,
+					 const TransferOptions &local, WorkerPool &pool);
 
-// Listen for a request
-void listen_for_requests(int sockfd, Frame &request);
+// Serve requests until the reactor is stopped
+void dispatch_requests(Dispatcher &dispatcher, Reactor &reactor);
 
 #endif
\ No newline at end of file
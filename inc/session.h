@@ -0,0 +1,94 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "frame.h"
+#include "inbox.h"
+#include "metrics.h"
+#include "options.h"
+#include "reactor.h"
+#include "rtt.h"
+#include "trace.h"
+#include "config.h"
+
+// What transfers went through, added up by the sessions pointing at it. Senders fill in the
+// frame counts and round trips when their transfer ends, receivers when the first data came
+struct TransferStats {
+	mutex lock;
+	uint64_t frames_sent;  // data and end frames, retransmissions included
+	uint64_t retransmits;
+	vector<int64_t> rtts;	 // round trip of every frame acked without being resent
+	int64_t first_data_at;	 // now_us() of the first data frame received, 0 before
+};
+
+// One conversation with a peer: where to send, what was negotiated and how long it takes
+struct Session {
+	Reactor *reactor;  // event loop the exchanges run on
+	int timer;		   // retransmission and idle timer of this session
+	int sockfd;
+	Inbox *inbox;  // where frames come from when a dispatcher owns the socket, else nullptr
+	int timeout_seconds;  // silence after which the peer is given up on
+	TransferOptions options;
+	RttEstimator rtt;
+	int window_limit;	   // most frames in flight, WINDOW_MAX unless a benchmark sweeps it
+	TransferStats *stats;  // nullptr unless someone measures
+	Metrics *metrics;	   // counted in every metrics snapshot while the session is open
+};
+
+// Frames are read straight from sockfd until an inbox is set
+void session_init(Session &session, Reactor &reactor, int sockfd, int timeout_seconds,
+				  const TransferOptions &options);
+
+// Releases the session timer and adds the session metrics to the totals
+void session_close(Session &session);
+
+// Descriptor that becomes readable when session_receive has something
+int session_fd(const Session &session);
+
+// Next frame of this session, valid until the next call. Frames of other sessions are
+// skipped, nullptr once nothing is left
+const Frame *session_receive(Session &session);
+
+// The dispatcher ended the session, the peer moved on to another request
+bool session_closed(const Session &session);
+
+
+/*FUNCTIONS TO SEND DATA*/
+
+// send frame until gets ack, retransmitting after the session RTO.
+// false when the peer went silent or the session was closed
+bool send_frame_and_receive_ack(Session &session, Frame &frame);
+
+// send frame until gets ack, keeping the ack (it may carry negotiated options)
+bool send_frame_and_receive_ack(Session &session, Frame &frame, Frame &ack);
+
+/*FUNCTIONS TO RECEIVE DATA*/
+
+// receive data, send nack until right. false when the peer went silent or the session was closed
+bool receive_frame_and_send_ack(Session &session, uint16_t seq, Frame &frame);
+
+// send ack for frame sequence
+void send_ack(Session &session, uint16_t sequence);
+
+// send nack for frame sequence
+void send_nack(Session &session, uint16_t sequence);
+
+// A SACK payload starts with how many frames the receiver rebuilt from parity since its last
+// SACK, the bitmap follows
+#define SACK_BITMAP_OFFSET 1
+
+// send a SACK: everything up to cumulative arrived, and so did each of the count frames after
+// the first missing one whose slot is set in received, first_slot being the slot of cumulative + 1
+void send_sack(Session &session, uint16_t cumulative, const vector<bool> &received,
+			   int first_slot, int count, uint8_t recovered);
+
+// whether a SACK says sequence arrived
+bool sack_covers(const Frame &sack, uint16_t sequence);
+
+// frames the receiver rebuilt from parity, see fec.h
+uint8_t sack_recovered(const Frame &sack);
+
+#endif
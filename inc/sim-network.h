@@ -0,0 +1,59 @@
+#ifndef SIM_NETWORK_H
+#define SIM_NETWORK_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "transport.h"
+#include "config.h"
+
+using namespace std;
+
+// How the simulated link treats every packet. Probabilities are per packet
+struct SimConfig {
+	int64_t latency_us;		// one way
+	int64_t bandwidth_bps;	// of the link into each endpoint, 0 for no limit
+	int64_t queue_bytes;	// most bytes waiting for the bandwidth, more are dropped
+	double loss;
+	double reorder;		 // held back up to reorder_us more than the packets around it
+	int64_t reorder_us;
+	double duplicate;	 // delivered twice
+	double corrupt;		 // one of its bits flipped
+	uint32_t seed;		 // of the generators the decisions come from, one per sending endpoint
+};
+
+// What happened to the packets sent over a network
+struct SimStats {
+	uint64_t sent;
+	uint64_t lost;
+	uint64_t queue_drops;
+	uint64_t reordered;
+	uint64_t duplicated;
+	uint64_t corrupted;
+};
+
+struct SimEndpoint;
+
+// Endpoints in one process exchanging packets through a lossy link model, a transport backend
+// that needs no privileges or NIC. Packets are addressed by MAC like on the wire, and an
+// endpoint polls readable once its next packet is due
+struct SimNetwork {
+	mutex lock;
+	SimConfig config;
+	SimStats stats;
+	vector<SimEndpoint *> receivers;
+	uint32_t endpoints;	 // created so far, each sender seeds its generator with its number
+};
+
+// A link that delivers everything at once
+SimConfig sim_config_perfect();
+
+void sim_network_init(SimNetwork &network, const SimConfig &config);
+
+// Endpoint receiving what is sent to mac or broadcast, registered as a transport endpoint
+int sim_endpoint_create(SimNetwork &network, const uint8_t *mac, int timeout_seconds);
+
+SimStats sim_network_stats(SimNetwork &network);
+
+#endif
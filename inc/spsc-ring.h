@@ -0,0 +1,93 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Bounded lock free queue for exactly one producer thread and one consumer thread.
+// Capacity is a power of two. The indexes only grow and sit on their own cache lines.
+template <typename T>
+struct SpscRing {
+	vector<T> items;
+	size_t mask;
+	alignas(64) atomic<size_t> head;  // next slot the producer writes
+	alignas(64) atomic<size_t> tail;  // next slot the consumer reads
+};
+
+template <typename T>
+void spsc_init(SpscRing<T> &ring, size_t capacity) {
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	ring.items.resize(size);
+	ring.mask = size - 1;
+	ring.head = 0;
+	ring.tail = 0;
+}
+
+// false when full
+template <typename T>
+bool spsc_push(SpscRing<T> &ring, const T &item) {
+	size_t head = ring.head.load(memory_order_relaxed);
+	if (head - ring.tail.load() > ring.mask) {
+		return false;
+	}
+	ring.items[head & ring.mask] = item;
+	ring.head.store(head + 1);
+	return true;
+}
+
+// false when empty
+template <typename T>
+bool spsc_pop(SpscRing<T> &ring, T &item) {
+	size_t tail = ring.tail.load(memory_order_relaxed);
+	if (tail == ring.head.load()) {
+		return false;
+	}
+	item = ring.items[tail & ring.mask];
+	ring.tail.store(tail + 1);
+	return true;
+}
+
+// In place variants for items that own a buffer: reserve the next free item, fill it and
+// commit it; look at the oldest one and release it once it is no longer needed.
+// nullptr when full or empty
+template <typename T>
+T *spsc_reserve(SpscRing<T> &ring) {
+	size_t head = ring.head.load(memory_order_relaxed);
+	if (head - ring.tail.load() > ring.mask) {
+		return nullptr;
+	}
+	return &ring.items[head & ring.mask];
+}
+
+template <typename T>
+void spsc_commit(SpscRing<T> &ring) {
+	ring.head.store(ring.head.load(memory_order_relaxed) + 1);
+}
+
+template <typename T>
+T *spsc_front(SpscRing<T> &ring) {
+	size_t tail = ring.tail.load(memory_order_relaxed);
+	if (tail == ring.head.load()) {
+		return nullptr;
+	}
+	return &ring.items[tail & ring.mask];
+}
+
+template <typename T>
+void spsc_release(SpscRing<T> &ring) {
+	ring.tail.store(ring.tail.load(memory_order_relaxed) + 1);
+}
+
+// items queued, exact only from the producer or the consumer thread
+template <typename T>
+size_t spsc_size(const SpscRing<T> &ring) {
+	return ring.head.load() - ring.tail.load();
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+#include "config.h"
+
+using namespace std;
+
+// What a trace event records, value depends on it
+#define TRACE_SENT 0x01		  // a data frame went out for the first time
+#define TRACE_RESENT 0x02	  // a frame went out again after a NACK or a SACK
+#define TRACE_TIMEOUT 0x03	  // a frame went out again after its timer expired, value is the RTO
+#define TRACE_DELIVERED 0x04  // a frame arrived in order
+#define TRACE_NACK 0x05		  // a frame was reported missing
+#define TRACE_DUPLICATE 0x06  // a frame arrived that was already there
+#define TRACE_CORRUPT 0x07	  // a frame failed its checksum
+#define TRACE_REBUILT 0x08	  // a lost frame was rebuilt from parity
+#define TRACE_WINDOW 0x09	  // the send window changed, value is its size in frames
+
+// Records an event in the trace ring, a circular buffer of the last TRACE_RING_EVENTS events
+// of the whole process. Takes a slot with one atomic increment and never blocks, so it is cheap
+// enough for every frame
+void trace_event(uint8_t type, uint16_t session, uint16_t sequence, uint32_t value);
+
+// Writes the events in the ring, oldest first, one per line: time in us, event, session,
+// sequence and value. Events being written while it reads are skipped. false on write errors
+bool trace_dump(const string &path);
+
+string trace_type_name(uint8_t type);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <cstdint>
+
+#include "config.h"
+
+using namespace std;
+
+#define SOCKET_TIMEOUT -1  // wait as long as the endpoint timeout says
+
+// What a backend does for an endpoint. Endpoints are descriptors that poll readable while a
+// packet waits, so reactors watch raw sockets and simulated links alike
+struct TransportOps {
+	// Points packet at the next packet, valid until the next receive on the endpoint.
+	// Its length, or -1 after timeout_us (0 to only take what is already queued)
+	ssize_t (*receive)(int fd, uint8_t **packet, int64_t timeout_us);
+	// Sends count messages, each to the sockaddr_ll in its msg_name. A full queue drops the rest
+	void (*send_batch)(int fd, struct mmsghdr *messages, unsigned int count);
+	// An endpoint that only sends, from the same host as fd, to peer
+	int (*create_sender)(int fd, const uint8_t *peer);
+	void (*set_peer)(int fd, const uint8_t *mac);
+	const uint8_t *(*last_source)(int fd);
+	const struct sockaddr_ll *(*peer)(int fd);
+	void (*close)(int fd);
+};
+
+// Backends register every endpoint they create
+void transport_register(int fd, const TransportOps *ops);
+
+ssize_t transport_receive(int fd, uint8_t **packet, int64_t timeout_us);
+
+void transport_send_batch(int fd, struct mmsghdr *messages, unsigned int count);
+
+// An endpoint that only sends, to peer, through the same backend and host as fd
+int transport_create_sender(int fd, const uint8_t *peer);
+
+// An endpoint that only sends, to the peer of fd
+int transport_clone_sender(int fd);
+
+// Destination of the frames sent from now on, broadcast until this is called
+void transport_set_peer(int fd, const uint8_t *mac);
+
+// Source address of the last packet received
+const uint8_t *transport_last_source(int fd);
+
+// Address to put in msg_name of every message sent
+const struct sockaddr_ll *transport_peer(int fd);
+
+// Releases the endpoint in its backend
+void transport_close(int fd);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <cstdint>
+
+#include "config.h"
+
+// Sender side sliding window that adapts to ACK/NACK and timeout feedback (AIMD)
+struct SendWindow {
+	double size;		 // frames allowed in flight
+	double threshold;	 // slow start threshold
+	bool in_recovery;	 // a loss in the current window was already handled
+	uint16_t recovery_end;
+	int max_size;		 // largest window reached during the transfer
+	int last_traced;
+	uint16_t session;	 // of the transfer, for the trace
+};
+
+// Starts a transfer with the initial window
+void window_init(SendWindow &window, uint16_t session);
+
+// Frames that may be in flight right now
+int window_frames(const SendWindow &window);
+
+// Grows the window after a cumulative ack of acked_frames ending at sequence
+void window_on_ack(SendWindow &window, uint16_t sequence, int acked_frames);
+
+// Halves the window once per loss event, next_sequence is the next unsent sequence
+void window_on_loss(SendWindow &window, uint16_t sequence, uint16_t next_sequence);
+
+// Collapses the window after the retransmission timeout of sequence
+void window_on_timeout(SendWindow &window, uint16_t sequence);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "reactor.h"
+#include "config.h"
+
+using namespace std;
+
+// Work for a pool thread, run on that thread's reactor
+typedef function<void(Reactor &)> Job;
+
+// Jobs waiting for one worker, the owner takes from the front and idle workers steal from the back
+struct WorkerQueue {
+	mutex lock;
+	deque<Job> jobs;
+};
+
+// Fixed set of threads with one reactor each. Jobs are spread round robin over the worker
+// queues and a worker that runs out steals from the others, so a busy worker never holds
+// a job back while another one sleeps
+struct WorkerPool {
+	vector<thread> threads;
+	unique_ptr<WorkerQueue[]> queues;
+	int workers;
+	atomic<unsigned int> next_queue;
+	atomic<int> pending;  // jobs queued and not taken yet
+	mutex idle_lock;
+	condition_variable idle;
+	bool stopping;
+};
+
+// Starts the workers, 0 means one per core
+void pool_start(WorkerPool &pool, int workers);
+
+// Queues a job for the next worker in turn
+void pool_submit(WorkerPool &pool, Job job);
+
+// Runs what is still queued, then joins every worker
+void pool_stop(WorkerPool &pool);
+
+#endif
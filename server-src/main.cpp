@@ -7,30 +7,30 @@ int main() {
 	const char *interface_name = INTERFACE_NAME;
 	int timeout_seconds = TIMEOUT_SECONDS;
 	int sockfd = raw_socket_create(interface_name, timeout_seconds);
+	TransferOptions local = local_options(get_interface_mtu(interface_name));
 
 	cout << "Server started" << endl;
 
-	Frame request;
+	// before any other thread starts, see metrics_serve
+	MetricsServer metrics;
+	metrics_serve(metrics, METRICS_SOCKET);
+	// this thread only routes frames, transfers run on the pool
+	WorkerPool pool;
+	pool_start(pool, WORKER_THREADS);
+	Reactor reactor;
+	reactor_init(reactor);
+	Dispatcher dispatcher;
+	dispatcher_init(dispatcher, sockfd, timeout_seconds, local, pool);
+	// read in meanwhile, the first requests may come before
+	frame_cache_warm(dispatcher.cache, FRAME_CACHE_WARM_LIST, local.payload_size);
 
-	while (true) {
-		listen_for_requests(sockfd, request);
-		switch (request.type) {
-			case TYPE_LIST:
-				send_ack(sockfd, request.sequence);
-				cout << "Got list request" << endl;
-				handle_list_request(sockfd, timeout_seconds);
-				break;
-			case TYPE_DOWNLOAD:
-				send_ack(sockfd, request.sequence);
-				cout << "Got download request" << endl;
-				handle_download_request(sockfd, request, timeout_seconds);
-				break;
-			default:
-				if (SHOW_LOGS == 1) cout << "Invalid request received" << endl;
-				break;
-		}
-	}
+	dispatch_requests(dispatcher, reactor);
 
-	close(sockfd);
+	pool_stop(pool);
+	metrics_stop(metrics);
+	catalog_close(dispatcher.catalog);
+	frame_cache_close(dispatcher.cache);
+	reactor_close(reactor);
+	transport_close(sockfd);
 	return 0;
 }
@@ -0,0 +1,205 @@
+#include "../inc/catalog.h"
+
+#include <dirent.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include "../inc/crc.h"
+
+// anything that changes which files there are or what their size and mtime are
+#define CATALOG_EVENTS                                                                     \
+	(IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | \
+	 IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// fixed part of a packed entry, the name comes on top
+#define PACKED_ENTRY_SIZE (1 + sizeof(uint64_t) + sizeof(int64_t) + sizeof(uint32_t))
+
+static int64_t mtime_ns(const struct stat &info) {
+	return info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+void catalog_open(Catalog &catalog, const string &directory) {
+	catalog.directory = directory;
+	catalog.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (catalog.inotify_fd < 0) {
+		perror("Failed to watch the file catalog, listings will scan the directory");
+	}
+	catalog.watching = false;
+	catalog.stale = true;
+}
+
+// Drains the events queued since the last listing, any of them makes the catalog stale
+static void read_changes(Catalog &catalog) {
+	alignas(struct inotify_event) char buffer[4096];
+	ssize_t length;
+	while ((length = read(catalog.inotify_fd, buffer, sizeof(buffer))) > 0) {
+		catalog.stale = true;
+		for (ssize_t offset = 0; offset < length;) {
+			const struct inotify_event *event = (const struct inotify_event *)(buffer + offset);
+			// the directory was removed or replaced, the watch went with it
+			if (event->mask & IN_IGNORED) {
+				catalog.watching = false;
+			}
+			offset += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+static uint32_t hash_file(int directory_fd, const char *name, uint64_t size) {
+	int fd = openat(directory_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	uint32_t hash = 0;
+	void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (data != MAP_FAILED) {
+		madvise(data, size, MADV_SEQUENTIAL);
+		hash = crc32c(0, (const uint8_t *)data, size);
+		munmap(data, size);
+	}
+	close(fd);
+	return hash;
+}
+
+static bool scan(Catalog &catalog, vector<CatalogEntry> &entries) {
+	DIR *dp = opendir(catalog.directory.c_str());
+	if (dp == nullptr) {
+		return false;
+	}
+
+	// hashes of files that didn't change since the last scan are kept
+	unordered_map<string, const CatalogEntry *> previous;
+	if (catalog.entries != nullptr) {
+		for (const CatalogEntry &entry : *catalog.entries) {
+			previous[entry.name] = &entry;
+		}
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dp))) {
+		struct stat info;
+		if (fstatat(dirfd(dp), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0 ||
+			!S_ISREG(info.st_mode)) {
+			continue;
+		}
+
+		CatalogEntry file = {entry->d_name, (uint64_t)info.st_size, info.st_mtime, 0,
+							 mtime_ns(info)};
+		if (CATALOG_HASH == 1) {
+			// a file rewritten within the second it was hashed in keeps its mtime in seconds
+			auto known = previous.find(file.name);
+			if (known != previous.end() && known->second->size == file.size &&
+				known->second->mtime_ns == file.mtime_ns) {
+				file.hash = known->second->hash;
+			} else {
+				file.hash = hash_file(dirfd(dp), entry->d_name, file.size);
+			}
+		}
+		entries.push_back(file);
+	}
+	closedir(dp);
+
+	sort(entries.begin(), entries.end(),
+		 [](const CatalogEntry &a, const CatalogEntry &b) { return a.name < b.name; });
+	return true;
+}
+
+bool catalog_snapshot(Catalog &catalog, shared_ptr<const vector<CatalogEntry>> &entries,
+					  shared_ptr<const vector<uint8_t>> &packed) {
+	lock_guard<mutex> guard(catalog.lock);
+	if (catalog.inotify_fd >= 0) {
+		read_changes(catalog);
+	}
+	// the watch is set before scanning, so a change made during the scan shows next time
+	if (!catalog.watching) {
+		catalog.watching = catalog.inotify_fd >= 0 &&
+						   inotify_add_watch(catalog.inotify_fd, catalog.directory.c_str(),
+											 CATALOG_EVENTS) >= 0;
+		catalog.stale = true;
+	}
+
+	if (catalog.stale) {
+		vector<CatalogEntry> scanned;
+		if (!scan(catalog, scanned)) {
+			return false;
+		}
+		catalog.packed = make_shared<const vector<uint8_t>>(catalog_pack(scanned));
+		catalog.entries = make_shared<const vector<CatalogEntry>>(move(scanned));
+		catalog.stale = false;
+		if (SHOW_LOGS == 1) {
+			cout << "Catalog of " << catalog.directory << " rebuilt, " << catalog.entries->size()
+				 << " files" << endl;
+		}
+	}
+
+	entries = catalog.entries;
+	packed = catalog.packed;
+	return true;
+}
+
+void catalog_close(Catalog &catalog) {
+	if (catalog.inotify_fd >= 0) {
+		close(catalog.inotify_fd);
+	}
+}
+
+vector<uint8_t> catalog_pack(const vector<CatalogEntry> &entries) {
+	vector<uint8_t> packed;
+	for (const CatalogEntry &entry : entries) {
+		uint8_t name_length = min<size_t>(entry.name.size(), UINT8_MAX);
+		uint64_t size = htobe64(entry.size);
+		uint64_t mtime = htobe64(entry.mtime);
+		uint32_t hash = htobe32(entry.hash);
+
+		size_t offset = packed.size();
+		packed.resize(offset + PACKED_ENTRY_SIZE + name_length);
+		uint8_t *out = packed.data() + offset;
+		*out++ = name_length;
+		memcpy(out, entry.name.data(), name_length);
+		out += name_length;
+		memcpy(out, &size, sizeof(size));
+		out += sizeof(size);
+		memcpy(out, &mtime, sizeof(mtime));
+		out += sizeof(mtime);
+		memcpy(out, &hash, sizeof(hash));
+	}
+	return packed;
+}
+
+bool catalog_unpack(const uint8_t *data, size_t size, vector<CatalogEntry> &entries) {
+	size_t offset = 0;
+	while (offset < size) {
+		uint8_t name_length = data[offset];
+		if (offset + PACKED_ENTRY_SIZE + name_length > size) {
+			return false;
+		}
+		const uint8_t *in = data + offset + 1;
+		CatalogEntry entry;
+		uint64_t file_size, mtime;
+		uint32_t hash;
+		entry.name.assign((const char *)in, name_length);
+		in += name_length;
+		memcpy(&file_size, in, sizeof(file_size));
+		in += sizeof(file_size);
+		memcpy(&mtime, in, sizeof(mtime));
+		in += sizeof(mtime);
+		memcpy(&hash, in, sizeof(hash));
+		entry.size = be64toh(file_size);
+		entry.mtime = (int64_t)be64toh(mtime);
+		entry.hash = be32toh(hash);
+		entry.mtime_ns = 0;
+		entries.push_back(entry);
+		offset += PACKED_ENTRY_SIZE + name_length;
+	}
+	return true;
+}
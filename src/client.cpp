@@ -2,188 +2,627 @@
 
 using namespace std;
 
-int calculateIndex(int baseSeqNum, int seqNum) {
-		int seq = baseSeqNum;
-    for (int i = 0;;i++) {
-			if (seq == seqNum) return i;
-			seq = (seq+1) % MAX_SEQ;
-		}
-}
+bool receive_file(Session &session, FileWriter &file, uint64_t origin, uint64_t &in_order) {
+	// frames that arrived ahead of the expected one, the sender window never exceeds WINDOW_MAX.
+	// Their payload goes to the writer right away, only the fact they arrived is kept
+	vector<bool> received(WINDOW_MAX, false);
+	vector<bool> nacked(WINDOW_MAX, false);
+	vector<bool> end_tx(WINDOW_MAX, false);
+	int window_start = 0;  // slot of the expected sequence
+	uint16_t expected_sequence = 0;
+	uint64_t delivered = 0;	 // frames before the expected one, to place payloads in the file
+	in_order = 0;			 // their bytes, nothing is missing before them
+	int ahead = 0;			 // furthest a received frame is past the expected one
 
-void receive_bugged_window(int sockfd, ofstream &file, uint8_t first_seq) {
-	vector<Frame> window(WINDOW_SIZE);
-	vector<int> hasReceived(WINDOW_SIZE, 0);
-	Frame frame;
-	int received = 0;
-	int end_tx_index = INT8_MAX;
-
-	if (SHOW_LOGS == 1) cout << "Receiving bugged window starting from frame " << (int)first_seq << endl;
-	while (received < WINDOW_SIZE) {
-		ssize_t bytes_received = recv(sockfd, (void*) &frame, sizeof(Frame), 0); 
-			if (bytes_received < 0 || frame.start_marker != START_MARKER) {
-				continue;
-			} else if (frame.type == TYPE_END_TX) {
-				end_tx_index = (calculateIndex(first_seq, (int)frame.sequence));
-				break;
-			}
-			window[calculateIndex(first_seq, (int)frame.sequence)] = frame;
-			hasReceived[calculateIndex(first_seq, (int)frame.sequence)] = 1;
-			received++;
-	}
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<> dist(1, ERRORS_FREQ_DOWNLOAD);
 
-	for (int i = 0; i < WINDOW_SIZE && i < end_tx_index; i++) {
-		if (hasReceived[i] == 0) {
-			send_nack(sockfd, first_seq);
-			return receive_bugged_window(sockfd, file, first_seq);
-		}
-	}
+	Reactor &reactor = *session.reactor;
+	bool finished = false;
+	bool complete = false;
+	bool got_data = false;
 
-	for (int i = 0; i < WINDOW_SIZE && i < end_tx_index; i++) {
-		Frame f = window[i];
-		if (SHOW_LOGS == 1) cout << "Got frame " << (int)f.sequence << endl;
-		file.write((char *)f.data, f.length);
-	}
+	// Legacy peers get an ACK or a NACK for every event. Others get a SACK once
+	// SACK_EVERY_FRAMES frames went unreported, right away when one went missing, and
+	// SACK_DELAY_US after the last frame otherwise
+	const bool selective = session.options.selective_ack;
+	int unreported = 0;
+	bool urgent = false;
+	int sack_timer = reactor_create_timer(reactor);
 
-	if (end_tx_index < INT8_MAX) {
-		send_ack(sockfd, window[end_tx_index].sequence);
-		cout << "File downloaded" << endl;
-		exit(0);
+	// frames rebuilt from parity are reported too, the sender sizes the parity on them
+	FecDecoder fec;
+	if (session.options.fec) {
+		fec_decoder_init(fec, session.options.payload_size);
 	}
-	send_ack(sockfd, window[WINDOW_SIZE - 1].sequence);
+	int recovered = 0;
 
-	return;
-}
+	auto send_feedback = [&]() {
+		send_sack(session, (expected_sequence + MAX_SEQ - 1) % MAX_SEQ, received, window_start,
+				  ahead, min(recovered, UINT8_MAX));
+		recovered = 0;
+		unreported = 0;
+		urgent = false;
+		reactor_arm_timer(sack_timer, TIMER_OFF);
+	};
 
-bool receive_file(int sockfd, ofstream &file) {
-	uint8_t first_window_seq = 0, last_window_seq = WINDOW_SIZE - 1, expected_sequence = 0;
-	unordered_set<uint8_t> window_frames_written;
-	int nacks_sent = 0;
-	cout << "Receiving file..." << endl;
+	auto report_missing = [&](uint16_t sequence) {
+		if (selective) {
+			metric_add(session.metrics->nacks);
+			trace_event(TRACE_NACK, session.options.session_id, sequence, 0);
+			urgent = true;
+		} else {
+			send_nack(session, sequence);
+		}
+	};
 
-	random_device rd;
-	mt19937 gen(rd());
-	uniform_int_distribution<> dist(1, ERRORS_FREQ_DOWNLOAD);
+	auto report_delivered = [&]() {
+		if (selective) {
+			unreported++;
+		} else {
+			send_ack(session, (expected_sequence + MAX_SEQ - 1) % MAX_SEQ);
+		}
+	};
+
+	// A stream only takes bytes in order, frames that arrive early wait in their slot here.
+	// So do those of a compressed transfer, its blocks run on from frame to frame
+	const uint16_t payload_size = session.options.payload_size;
+	const bool compressed = session.options.compressed;
+	const bool in_sequence = file.sequential || compressed;
+	vector<uint8_t> early(in_sequence ? WINDOW_MAX * payload_size : 0);
+	vector<uint16_t> early_length(WINDOW_MAX);
+	BlockDecoder decoder;
+	if (compressed) {
+		block_decoder_init(decoder);
+	}
 
-	while(true) {
-		Frame frame;
-		ssize_t bytes_received = recv(sockfd, static_cast<void *>(&frame), sizeof(Frame), 0);
-		if (bytes_received < 0 || frame.start_marker != START_MARKER) {
-			continue;
+	// every data frame but the last is full, so a frame's place follows from its index.
+	// Compressed blocks are placed by their raw size, the writer takes a frame's worth at once
+	auto deliver = [&](uint64_t index, const uint8_t *data, uint16_t length) {
+		if (!compressed) {
+			file_writer_write(file, origin + index * payload_size, data, length);
+			return;
+		}
+		block_decoder_feed(decoder, data, length, [&](const uint8_t *raw, size_t size) {
+			for (size_t done = 0; done < size; done += payload_size) {
+				file_writer_write(file, origin + decoder.decoded + done, raw + done,
+								  min<size_t>(payload_size, size - done));
+			}
+		});
+	};
+
+	auto place = [&](const Frame &frame, uint64_t index) {
+		if (frame.type != TYPE_DATA || frame.length == 0) {
+			return;
+		}
+		if (in_sequence && index != delivered) {
+			int slot = (window_start + (index - delivered)) % WINDOW_MAX;
+			memcpy(&early[slot * payload_size], frame.data, frame.length);
+			return;
 		}
+		deliver(index, frame.data, frame.length);
+	};
 
+	auto handle_frame = [&](const Frame &frame) {
 		// Got error
 		if (frame.type == TYPE_ERROR) {
-			send_ack(sockfd, frame.sequence);
-			return false;
+			send_ack(session, frame.sequence);
+			finished = true;
+			return;
+		}
+
+		if (frame.type != TYPE_DATA && frame.type != TYPE_END_TX) {
+			return;
 		}
 
 		int rand = TEST_ERRORS == 1 ? dist(gen) : -1;
 
-		// Something went wrong, send nack
-		if (frame.crc != calculate_crc(frame) || frame.sequence != expected_sequence || rand == 1) {
-			// jogar fora o resto da janela
-			uint8_t received = window_frames_written.size() + 1;
-			while (received < WINDOW_SIZE) {
-				recv(sockfd, static_cast<void *>(&frame), sizeof(Frame), 0);
-				if (frame.start_marker == START_MARKER) {
-					if (frame.type == TYPE_END_TX) {
-						break;
-					}
-					received++;
-				}
+		// Corrupted frame, its sequence can't be trusted so ask for the expected one
+		if (!frame_intact(frame) || rand == 1) {
+			if (!received[window_start] && !nacked[window_start]) {
+				nacked[window_start] = true;
+				report_missing(expected_sequence);
 			}
+			return;
+		}
 
-			// window is 'bugged'
-			if (nacks_sent > 2 && FIX_BUGGED_WINDOWS == 1) {
-				send_nack(sockfd, expected_sequence);
-				receive_bugged_window(sockfd, file, expected_sequence);
-				window_frames_written.clear();
-				first_window_seq = (expected_sequence + WINDOW_SIZE) % MAX_SEQ;
-				last_window_seq = (first_window_seq + WINDOW_SIZE - 1) % MAX_SEQ;
-				expected_sequence = first_window_seq;
-				nacks_sent = 0;
-				continue;
+		if (session.stats != nullptr && frame.type == TYPE_DATA && !got_data) {
+			lock_guard<mutex> guard(session.stats->lock);
+			if (session.stats->first_data_at == 0) {
+				session.stats->first_data_at = now_us();
 			}
+		}
+		got_data = got_data || frame.type == TYPE_DATA;
 
-			// send nack and update window
-			window_frames_written.clear();
-			first_window_seq = expected_sequence;
-			last_window_seq = (first_window_seq + WINDOW_SIZE - 1) % MAX_SEQ;
-			nacks_sent++;
-			send_nack(sockfd, expected_sequence);
-		} else if (frame.type == TYPE_END_TX) {
-			send_ack(sockfd, frame.sequence);
-			return true;
-		} else {
-			nacks_sent = 0;
-			if (window_frames_written.find(frame.sequence) == window_frames_written.end()) {
-				window_frames_written.insert(frame.sequence);
-				if (SHOW_LOGS == 1) cout << "Got frame " << (int)frame.sequence << endl;
-				file.write((char *)frame.data, frame.length);
+		if (session.options.fec && frame.type == TYPE_DATA) {
+			fec_remember(fec, frame);
+		}
+
+		int offset = seq_offset(expected_sequence, frame.sequence);
+		if (offset >= WINDOW_MAX) {
+			// duplicate of a delivered frame, our ack was lost
+			metric_add(session.metrics->duplicates);
+			trace_event(TRACE_DUPLICATE, frame.session, frame.sequence, 0);
+			if (selective) {
+				urgent = true;
+			} else {
+				send_ack(session, (expected_sequence + MAX_SEQ - 1) % MAX_SEQ);
 			}
+			return;
+		}
 
-			if (frame.sequence == last_window_seq) {
-				send_ack(sockfd, last_window_seq);
-				window_frames_written.clear();
-				first_window_seq = (expected_sequence + 1) % MAX_SEQ;
-				last_window_seq = (first_window_seq + WINDOW_SIZE - 1) % MAX_SEQ;
+		if (offset > 0) {
+			int slot = (window_start + offset) % WINDOW_MAX;
+			if (received[slot]) {
+				metric_add(session.metrics->duplicates);
+				trace_event(TRACE_DUPLICATE, frame.session, frame.sequence, 0);
+			} else {
+				place(frame, delivered + offset);
+				early_length[slot] = frame.type == TYPE_DATA ? frame.length : 0;
+				received[slot] = true;
+				end_tx[slot] = frame.type == TYPE_END_TX;
+				ahead = max(ahead, offset);
 			}
+
+			// frames before this one are missing, nack each of them once
+			for (int i = 0; i < offset; i++) {
+				int missing = (window_start + i) % WINDOW_MAX;
+				if (!received[missing] && !nacked[missing]) {
+					nacked[missing] = true;
+					report_missing((expected_sequence + i) % MAX_SEQ);
+				}
+			}
+			unreported++;
+			return;
+		}
+
+		// deliver the expected frame and every one already received after it
+		place(frame, delivered);
+		bool end = frame.type == TYPE_END_TX;
+		uint16_t length = frame.type == TYPE_DATA ? frame.length : 0;
+		while (true) {
+			if (end) {
+				send_ack(session, expected_sequence);
+				finished = true;
+				complete = !compressed || block_decoder_done(decoder);
+				if (!complete) {
+					cout << "Compressed data is damaged" << endl;
+				}
+				return;
+			}
+			trace_event(TRACE_DELIVERED, session.options.session_id, expected_sequence, length);
+
+			received[window_start] = false;
+			nacked[window_start] = false;
+			window_start = (window_start + 1) % WINDOW_MAX;
 			expected_sequence = (expected_sequence + 1) % MAX_SEQ;
+			delivered++;
+			in_order = compressed ? decoder.decoded : in_order + length;
+			ahead = max(ahead - 1, 0);
+			if (!received[window_start]) {
+				break;
+			}
+			end = end_tx[window_start];
+			length = early_length[window_start];
+			if (in_sequence && !end) {
+				deliver(delivered, &early[window_start * payload_size], early_length[window_start]);
+			}
+		}
+
+		report_delivered();
+	};
+
+	// a lost or corrupted frame the parity can rebuild needs no retransmission
+	auto handle_parity = [&](const Frame &parity) {
+		if (!session.options.fec || !frame_intact(parity)) {
+			return;
+		}
+		const Frame *rebuilt = fec_recover(fec, parity);
+		if (rebuilt == nullptr) {
+			return;
+		}
+		// the history is shorter than the window, so the original may have been delivered or
+		// received already and forgotten since. Only a frame still missing counts as rebuilt
+		int offset = seq_offset(expected_sequence, rebuilt->sequence);
+		if (offset >= WINDOW_MAX || received[(window_start + offset) % WINDOW_MAX]) {
+			return;
 		}
+		metric_add(session.metrics->rebuilt);
+		trace_event(TRACE_REBUILT, rebuilt->session, rebuilt->sequence, 0);
+		recovered++;
+		handle_frame(*rebuilt);
+	};
+
+	reactor_watch(reactor, session_fd(session), [&]() {
+		// frames are read in place from the receive ring, only out of order ones get copied
+		const Frame *frame;
+		while (!finished && (frame = session_receive(session)) != nullptr) {
+			bool pending = unreported > 0;
+			if (frame->type == TYPE_PARITY) {
+				handle_parity(*frame);
+			} else {
+				handle_frame(*frame);
+			}
+			if (selective && !finished && (urgent || unreported >= SACK_EVERY_FRAMES)) {
+				send_feedback();
+			} else if (selective && !pending && unreported > 0) {
+				reactor_arm_timer(sack_timer, SACK_DELAY_US);
+			}
+		}
+		if (file.failed) {
+			cout << "Output closed, transfer abandoned" << endl;
+			finished = true;
+		}
+		if (finished) {
+			reactor_stop(reactor);
+		} else {
+			reactor_arm_timer(session.timer, session.timeout_seconds * 1000000LL);
+		}
+	});
+
+	reactor_watch(reactor, sack_timer, [&]() {
+		send_feedback();
+	});
+
+	// the sender retransmits on its own, only a silent one is given up on
+	reactor_watch(reactor, session.timer, [&]() {
+		cout << "Server stopped responding" << endl;
+		reactor_stop(reactor);
+	});
+
+	reactor_arm_timer(session.timer, session.timeout_seconds * 1000000LL);
+	reactor_run(reactor);
+	reactor_arm_timer(session.timer, TIMER_OFF);
+	reactor_unwatch(reactor, session_fd(session));
+	reactor_unwatch(reactor, session.timer);
+	reactor_destroy_timer(reactor, sack_timer);
+	return complete;
+}
+
+// A packed listing arrives like any download, into memory, and is read once complete
+static vector<RemoteFile> receive_listing(Session &session) {
+	int listing = memfd_create("listing", MFD_CLOEXEC);
+	if (listing < 0) {
+		perror("Failed to create listing buffer");
+		return {};
+	}
+	FileWriter writer;
+	file_writer_stream(writer, dup(listing), session.options.payload_size, WRITER_SLOTS);
+	uint64_t in_order;
+	bool received = receive_file(session, writer, 0, in_order);
+	bool written = file_writer_close(writer);
+
+	struct stat info;
+	vector<uint8_t> packed;
+	if (received && written && fstat(listing, &info) == 0) {
+		packed.resize(info.st_size);
+		if (pread(listing, packed.data(), packed.size(), 0) != (ssize_t)packed.size()) {
+			written = false;
+		}
+	}
+	close(listing);
+
+	vector<CatalogEntry> entries;
+	if (!received || !written || !catalog_unpack(packed.data(), packed.size(), entries)) {
+		cout << "Server failed to send file list" << endl;
+		return {};
 	}
-	return false;
+	vector<RemoteFile> file_list;
+	for (const CatalogEntry &entry : entries) {
+		file_list.push_back({entry.name, entry.size, entry.mtime});
+	}
+	return file_list;
 }
 
-vector<string> list_files(int sockfd, int timeout_seconds) {
-	Frame list_request = {};
+vector<RemoteFile> list_files(Session &session) {
+	ControlFrame control = {};
+	Frame &list_request = control_frame(control);
 	list_request.start_marker = START_MARKER;
 	list_request.length = 0;
 	list_request.sequence = 0;
 	list_request.type = TYPE_LIST;
+	TransferOptions offer = session.options;
+	offer.session_id = new_session_id();
+	write_options(list_request, offer);
 	list_request.crc = calculate_crc(list_request);
 
-	vector<string> file_list;
+	vector<RemoteFile> file_list;
 
-	send_frame_and_receive_ack(sockfd, list_request, timeout_seconds);
-	uint8_t next_seq_num = 0;
+	// the request is broadcast, from the ack on we talk to the server that answered.
+	// a server that acks without options stays legacy from then on
+	Frame ack;
+	session.options = legacy_options();
+	session.options.session_id = offer.session_id;
+	if (!send_frame_and_receive_ack(session, list_request, ack)) {
+		return {};
+	}
+	transport_set_peer(session.sockfd, transport_last_source(session.sockfd));
+	session.options = read_options(ack, 0);
+	if (session.options.packed_list) {
+		return receive_listing(session);
+	}
+
+	uint16_t next_seq_num = 0;
 	while (true) {
 		Frame frame = {};
-		receive_frame_and_send_ack(sockfd, next_seq_num, frame);
+		if (!receive_frame_and_send_ack(session, next_seq_num, frame)) {
+			return {};
+		}
 		if (frame.type == TYPE_END_TX) {
 			return file_list;
 		} else if (frame.type == TYPE_ERROR) {
 			cout << "Server failed to send file list" << endl;
 			return {};
 		}
-		file_list.push_back((char *)frame.data);
+		file_list.push_back({request_filename(frame), read_file_size(frame), 0});
 		next_seq_num = (next_seq_num + 1) % MAX_SEQ;
 	}
 }
 
-void download_file(int sockfd, const string &filename, int timeout_seconds) {
-	Frame frame;
+// Sends a DOWNLOAD or SHOWS_ON_SCREEN request for filename, or the range of it, and takes the
+// options the server agreed on. The frames of the new session are told apart by session_id,
+// which the caller picks
+static bool request_file(Session &session, const string &filename, uint8_t type,
+						 const ByteRange &range, uint16_t session_id) {
+	if (session.options.format != FORMAT_LEGACY) {
+		session.options.session_id = session_id;
+	}
+	const TransferOptions &options = session.options;
+	Frame frame = {};
 	frame.start_marker = START_MARKER;
-	frame.length = filename.size();
+	frame.length = min<size_t>(filename.size(), options.payload_size);
 	frame.sequence = 0;
-	frame.type = TYPE_DOWNLOAD;
+	frame.type = type;
 	strncpy((char *)frame.data, filename.c_str(), frame.length);
+	// options go after the name terminator, legacy servers get the bare name
+	bool whole_file = range.offset == 0 && range.length == 0;
+	if (options.format != FORMAT_LEGACY) {
+		frame.data[frame.length++] = '\0';
+		write_options(frame, options);
+		if (options.ranges && !whole_file) {
+			write_range(frame, range);
+		}
+	}
 	frame.crc = calculate_crc(frame);
 
-	ofstream file(filename, ios::binary);
-	if (!file.is_open()) {
-		cout << "Failed to create file " << filename << endl;
+	Frame ack;
+	if (!send_frame_and_receive_ack(session, frame, ack)) {
+		return false;
+	}
+	session.options = read_options(ack, 0);
+	// a server that ignored the range would send the file from its start
+	if (!whole_file && !session.options.ranges) {
+		cout << "Server can't send part of a file" << endl;
+		return false;
+	}
+	return true;
+}
+
+// Waits until what was written to path is on disk
+static bool sync_file(const string &path) {
+	int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	bool synced = fdatasync(fd) == 0;
+	close(fd);
+	return synced;
+}
+
+// Fetches the ranges one after the other over session
+static void fetch_in_turn(Session &session, const RemoteFile &remote,
+						  const vector<ByteRange> &ranges, bool keep, Journal &journal,
+						  bool &received, bool &written) {
+	// the server never agrees on larger frames than offered, so offered ones fit every chunk
+	FileWriter file;
+	received = false;
+	written = file_writer_open(file, remote.name, remote.size, session.options.payload_size, keep);
+	if (!written) {
 		return;
 	}
 
-	send_frame_and_receive_ack(sockfd, frame, timeout_seconds);
-	
-	if (!receive_file(sockfd, file)) {
-		file.close();
-		remove((char*)&filename);
-		cout << "Server failed to send file" << endl;
+	received = true;
+	for (const ByteRange &range : ranges) {
+		if (!request_file(session, remote.name, TYPE_DOWNLOAD, range, new_session_id())) {
+			received = false;
+			break;
+		}
+		cout << "Receiving file..." << endl;
+		uint64_t in_order;
+		received = receive_file(session, file, range.offset, in_order);
+		journal_add(journal, range.offset, in_order);
+		if (!received) {
+			break;
+		}
+	}
+	written = file_writer_close(file);
+}
+
+// Cuts ranges in parts of about the same size, count of them unless that makes parts smaller
+// than MIN_PART_BYTES
+static vector<ByteRange> split_ranges(const vector<ByteRange> &ranges, int count) {
+	uint64_t total = 0;
+	for (const ByteRange &range : ranges) {
+		total += range.length;
+	}
+	uint64_t part_size = max<uint64_t>(MIN_PART_BYTES, (total + count - 1) / count);
+
+	vector<ByteRange> parts;
+	for (const ByteRange &range : ranges) {
+		uint64_t end = range.offset + range.length;
+		for (uint64_t offset = range.offset; offset < end; offset += part_size) {
+			parts.push_back({offset, min(part_size, end - offset)});
+		}
+	}
+	return parts;
+}
+
+// Fetches each range over a session of its own, up to sessions of them at once. Every part
+// writes into the same file, which holds the whole size from the start
+static void fetch_in_parallel(Session &session, const RemoteFile &remote,
+							  const vector<ByteRange> &ranges, int sessions, Journal &journal,
+							  bool &received, bool &written) {
+	vector<DownloadPart> parts(ranges.size());
+	unordered_set<uint16_t> session_ids;
+	for (size_t i = 0; i < parts.size(); i++) {
+		parts[i].range = ranges[i];
+		parts[i].in_order = 0;
+		do {
+			parts[i].session_id = new_session_id();
+		} while (!session_ids.insert(parts[i].session_id).second);
+		inbox_init(parts[i].inbox);
+	}
+
+	int finished_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (finished_fd < 0) {
+		perror("Failed to create download event");
+		exit(EXIT_FAILURE);
+	}
+	WorkerPool pool;
+	pool_start(pool, min<int>(sessions, parts.size()));
+	for (DownloadPart &part : parts) {
+		pool_submit(pool, [&session, &remote, &part, finished_fd](Reactor &reactor) {
+			Session stream;
+			session_init(stream, reactor, transport_clone_sender(session.sockfd),
+						 session.timeout_seconds, session.options);
+			stream.inbox = &part.inbox;
+			stream.stats = session.stats;
+
+			FileWriter file;
+			part.received = false;
+			part.written = file_writer_open(file, remote.name, remote.size,
+											stream.options.payload_size, true);
+			if (part.written) {
+				part.received = request_file(stream, remote.name, TYPE_DOWNLOAD, part.range,
+											 part.session_id) &&
+								receive_file(stream, file, part.range.offset, part.in_order);
+				part.written = file_writer_close(file);
+			}
+			session_close(stream);
+			transport_close(stream.sockfd);
+			inbox_shutdown(part.inbox);
+
+			uint64_t one = 1;
+			if (write(finished_fd, &one, sizeof(one)) < 0) {
+				perror("Failed to signal download part");
+			}
+		});
+	}
+
+	// this thread owns the socket, it hands every frame to the part whose session it is
+	Reactor &reactor = *session.reactor;
+	size_t finished = 0;
+	reactor_watch(reactor, session.sockfd, [&]() {
+		const Frame *frame;
+		while ((frame = receive_frame_view(session.sockfd, 0)) != nullptr) {
+			for (DownloadPart &part : parts) {
+				if (frame->session == part.session_id) {
+					inbox_push(part.inbox, *frame);
+					break;
+				}
+			}
+		}
+	});
+	reactor_watch(reactor, finished_fd, [&]() {
+		uint64_t count;
+		if (read(finished_fd, &count, sizeof(count)) == sizeof(count)) {
+			finished += count;
+		}
+		if (finished == parts.size()) {
+			reactor_stop(reactor);
+		}
+	});
+	reactor_run(reactor);
+	reactor_unwatch(reactor, session.sockfd);
+	reactor_unwatch(reactor, finished_fd);
+	pool_stop(pool);
+	close(finished_fd);
+
+	received = true;
+	written = true;
+	for (DownloadPart &part : parts) {
+		journal_add(journal, part.range.offset, part.in_order);
+		received = received && part.received;
+		written = written && part.written;
+		inbox_close(part.inbox);
+	}
+}
+
+void download_file(Session &session, const RemoteFile &remote, int sessions) {
+	const string &filename = remote.name;
+
+	// without the size there is no telling what is missing, those downloads start over
+	bool resumable = session.options.ranges && remote.size > 0;
+	Journal journal;
+	journal_init(journal, filename, remote.size, remote.mtime);
+	bool resuming = resumable && journal_load(journal);
+	vector<ByteRange> missing = {{0, 0}};
+	if (resuming) {
+		missing = journal_missing(journal);
+		cout << "Resuming " << filename << ", " << journal_done_bytes(journal) << " of "
+			 << remote.size << " bytes already downloaded" << endl;
+	}
+
+	// a large file is cut in parts that are fetched at once, each with a window of its own
+	if (resumable && sessions > 1) {
+		missing = split_ranges(resuming ? missing : vector<ByteRange>{{0, remote.size}}, sessions);
+	}
+
+	bool received, written;
+	if (sessions > 1 && missing.size() > 1) {
+		// parts never empty the file, what an older version left is removed first
+		if (!resuming) {
+			remove(filename.c_str());
+		}
+		cout << "Receiving file in " << missing.size() << " parts over "
+			 << min<size_t>(sessions, missing.size()) << " sessions..." << endl;
+		fetch_in_parallel(session, remote, missing, sessions, journal, received, written);
 	} else {
-		file.close();
+		fetch_in_turn(session, remote, missing, resuming, journal, received, written);
+	}
+
+	if (received && written) {
+		journal_remove(journal);
 		cout << "File " << filename << " downloaded successfully" << endl;
+	} else if (written && resumable && journal_done_bytes(journal) > 0 && sync_file(filename) &&
+			   journal_save(journal)) {
+		// the data is on disk before the journal says so
+		cout << "Server failed to send file, " << journal_done_bytes(journal) << " of "
+			 << remote.size << " bytes kept to resume from" << endl;
+	} else {
+		remove(filename.c_str());
+		journal_remove(journal);
+		if (!written) {
+			cout << "Failed to write file " << filename << endl;
+		} else {
+			cout << "Server failed to send file" << endl;
+		}
+	}
+}
+
+void stream_file(Session &session, const RemoteFile &remote, int output) {
+	FileWriter stream;
+	file_writer_stream(stream, output, session.options.payload_size, STREAM_BUFFER_FRAMES);
+
+	int64_t requested_at = now_us();
+	if (!request_file(session, remote.name, TYPE_SHOWS_ON_SCREEN, {0, 0}, new_session_id())) {
+		file_writer_close(stream);
+		return;
+	}
+
+	cout << "Receiving file..." << endl;
+	uint64_t in_order;
+	bool received = receive_file(session, stream, 0, in_order);
+	int64_t finished_at = now_us();
+	bool written = file_writer_close(stream);
+	if (stream.first_write_us != 0) {
+		cout << "First bytes out after " << (stream.first_write_us - requested_at) / 1000.0
+			 << " ms, whole file after " << (finished_at - requested_at) / 1000.0 << " ms" << endl;
+	}
+	if (!received || !written) {
+		cout << "Stream of " << remote.name << " ended early" << endl;
+	} else {
+		cout << "File " << remote.name << " streamed successfully" << endl;
 	}
-	
-}
\ No newline at end of file
+}
@@ -0,0 +1,290 @@
+#include "../inc/compress.h"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 13
+#define LZ_SKIP_SHIFT 6	 // the longer nothing matched, the more positions are skipped
+#define LZ_SHORT_COPY 16  // copied whole when there is room for it, a fixed size copy is inlined
+#define COMPRESS_SAMPLES 4
+
+static inline uint32_t read32(const uint8_t *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t hash32(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Bytes a and b have in common, up to limit
+static size_t common_length(const uint8_t *a, const uint8_t *b, size_t limit) {
+	size_t length = 0;
+	while (length + sizeof(uint64_t) <= limit) {
+		uint64_t diff = read64(a + length) ^ read64(b + length);
+		if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return length + __builtin_ctzll(diff) / 8;
+#else
+			return length + __builtin_clzll(diff) / 8;
+#endif
+		}
+		length += sizeof(uint64_t);
+	}
+	while (length < limit && a[length] == b[length]) {
+		length++;
+	}
+	return length;
+}
+
+static inline uint8_t *write_length(uint8_t *out, size_t length) {
+	for (; length >= 255; length -= 255) {
+		*out++ = 255;
+	}
+	*out++ = length;
+	return out;
+}
+
+// Writes a sequence, match_length 0 for the last one. nullptr when it doesn't fit before end
+static uint8_t *write_sequence(uint8_t *out, uint8_t *end, const uint8_t *literals,
+							   size_t literal_length, size_t offset, size_t match_length) {
+	// token, both length extensions, the literals and the offset at most
+	if ((size_t)(end - out) < 1 + literal_length / 255 + 1 + literal_length + 2 +
+								  match_length / 255 + 1) {
+		return nullptr;
+	}
+	uint8_t *token = out++;
+	*token = min<size_t>(literal_length, 15) << 4;
+	if (literal_length >= 15) {
+		out = write_length(out, literal_length - 15);
+	}
+	memcpy(out, literals, literal_length);
+	out += literal_length;
+	if (match_length == 0) {
+		return out;
+	}
+
+	out[0] = offset & 0xFF;
+	out[1] = offset >> 8;
+	out += 2;
+	match_length -= LZ_MIN_MATCH;
+	*token |= min<size_t>(match_length, 15);
+	if (match_length >= 15) {
+		out = write_length(out, match_length - 15);
+	}
+	return out;
+}
+
+size_t lz_bound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+size_t lz_compress(const uint8_t *in, size_t size, uint8_t *out, size_t capacity) {
+	// positions a 4 byte sequence was last seen at, checked before use
+	uint32_t table[1 << LZ_HASH_BITS] = {};
+	uint8_t *start = out;
+	uint8_t *end = out + capacity;
+	size_t anchor = 0;	// first byte not written yet
+	size_t position = 1;
+
+	while (position + LZ_MIN_MATCH <= size) {
+		uint32_t sequence = read32(in + position);
+		uint32_t &slot = table[hash32(sequence)];
+		size_t candidate = slot;
+		slot = position;
+		if (position - candidate > LZ_MAX_OFFSET || read32(in + candidate) != sequence) {
+			position += 1 + ((position - anchor) >> LZ_SKIP_SHIFT);
+			continue;
+		}
+
+		size_t length = LZ_MIN_MATCH + common_length(in + candidate + LZ_MIN_MATCH,
+													 in + position + LZ_MIN_MATCH,
+													 size - position - LZ_MIN_MATCH);
+		out = write_sequence(out, end, in + anchor, position - anchor, position - candidate,
+							 length);
+		if (out == nullptr) {
+			return 0;
+		}
+		position += length;
+		anchor = position;
+	}
+
+	out = write_sequence(out, end, in + anchor, size - anchor, 0, 0);
+	return out == nullptr ? 0 : out - start;
+}
+
+static inline bool read_length(const uint8_t *in, size_t size, size_t &position, size_t &length) {
+	uint8_t byte;
+	do {
+		if (position >= size) {
+			return false;
+		}
+		byte = in[position++];
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+bool lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t raw_size) {
+	size_t in_position = 0;
+	size_t out_position = 0;
+	while (in_position < size) {
+		uint8_t token = in[in_position++];
+		size_t literal_length = token >> 4;
+		bool room = size - in_position >= LZ_SHORT_COPY && raw_size - out_position >= LZ_SHORT_COPY;
+		if (literal_length < 15 && room) {
+			// most sequences are short, what is copied past them is overwritten later
+			memcpy(out + out_position, in + in_position, LZ_SHORT_COPY);
+		} else {
+			if (literal_length == 15 && !read_length(in, size, in_position, literal_length)) {
+				return false;
+			}
+			if (literal_length > size - in_position || literal_length > raw_size - out_position) {
+				return false;
+			}
+			memcpy(out + out_position, in + in_position, literal_length);
+		}
+		in_position += literal_length;
+		out_position += literal_length;
+		if (in_position == size) {
+			break;
+		}
+
+		if (size - in_position < 2) {
+			return false;
+		}
+		size_t offset = in[in_position] | in[in_position + 1] << 8;
+		in_position += 2;
+		size_t match_length = token & 15;
+		if (match_length == 15 && !read_length(in, size, in_position, match_length)) {
+			return false;
+		}
+		match_length += LZ_MIN_MATCH;
+		if (offset == 0 || offset > out_position || match_length > raw_size - out_position) {
+			return false;
+		}
+
+		// a match may overlap what it produces, copied in steps that never do, each twice the
+		// size of the one before
+		const uint8_t *match = out + out_position - offset;
+		uint8_t *destination = out + out_position;
+		if (match_length <= LZ_SHORT_COPY && offset >= LZ_SHORT_COPY &&
+			raw_size - out_position >= LZ_SHORT_COPY) {
+			memcpy(destination, match, LZ_SHORT_COPY);
+			out_position += match_length;
+			continue;
+		}
+		out_position += match_length;
+		while (match_length > 0) {
+			size_t step = min<size_t>(destination - match, match_length);
+			memcpy(destination, match, step);
+			destination += step;
+			match_length -= step;
+		}
+	}
+	return out_position == raw_size;
+}
+
+size_t compress_block(const uint8_t *in, size_t size, uint8_t *out) {
+	size_t stored = lz_compress(in, size, out + COMPRESS_BLOCK_HEADER, size - 1);
+	if (stored == 0) {
+		memcpy(out + COMPRESS_BLOCK_HEADER, in, size);
+		stored = size;
+	}
+	uint32_t raw_length = htobe32(size);
+	uint32_t stored_length = htobe32(stored);
+	memcpy(out, &raw_length, sizeof(raw_length));
+	memcpy(out + sizeof(raw_length), &stored_length, sizeof(stored_length));
+	return COMPRESS_BLOCK_HEADER + stored;
+}
+
+double compress_sample(const uint8_t *data, size_t size) {
+	if (size == 0) {
+		return 1;
+	}
+	size_t sample = min<size_t>(COMPRESS_SAMPLE_BYTES, size / COMPRESS_SAMPLES);
+	size_t samples = COMPRESS_SAMPLES;
+	if (sample < COMPRESS_SAMPLE_BYTES) {
+		// small enough to look at all of it
+		sample = size;
+		samples = 1;
+	}
+
+	vector<uint8_t> out(sample);
+	size_t raw = 0;
+	size_t compressed = 0;
+	for (size_t i = 0; i < samples; i++) {
+		const uint8_t *at = data + (size - sample) / max<size_t>(samples - 1, 1) * i;
+		size_t length = lz_compress(at, sample, out.data(), out.size());
+		raw += sample;
+		compressed += length == 0 ? sample : length;
+	}
+	return (double)compressed / raw;
+}
+
+void block_decoder_init(BlockDecoder &decoder) {
+	decoder.block.resize(COMPRESS_BLOCK_HEADER + COMPRESS_BLOCK_BYTES);
+	decoder.filled = 0;
+	decoder.stored = 0;
+	decoder.raw.resize(COMPRESS_BLOCK_BYTES);
+	decoder.decoded = 0;
+	decoder.damaged = false;
+}
+
+bool block_decoder_feed(BlockDecoder &decoder, const uint8_t *data, size_t size,
+						const function<void(const uint8_t *, size_t)> &output) {
+	while (size > 0 && !decoder.damaged) {
+		size_t wanted = decoder.filled < COMPRESS_BLOCK_HEADER ? COMPRESS_BLOCK_HEADER
+															   : COMPRESS_BLOCK_HEADER + decoder.stored;
+		size_t taken = min(wanted - decoder.filled, size);
+		memcpy(decoder.block.data() + decoder.filled, data, taken);
+		decoder.filled += taken;
+		data += taken;
+		size -= taken;
+		if (decoder.filled < wanted) {
+			break;
+		}
+
+		uint32_t raw_length, stored_length;
+		memcpy(&raw_length, decoder.block.data(), sizeof(raw_length));
+		memcpy(&stored_length, decoder.block.data() + sizeof(raw_length), sizeof(stored_length));
+		raw_length = be32toh(raw_length);
+		stored_length = be32toh(stored_length);
+		if (wanted == COMPRESS_BLOCK_HEADER) {
+			decoder.damaged = raw_length == 0 || raw_length > COMPRESS_BLOCK_BYTES ||
+							  stored_length == 0 || stored_length > raw_length;
+			decoder.stored = stored_length;
+			continue;
+		}
+
+		const uint8_t *stored = decoder.block.data() + COMPRESS_BLOCK_HEADER;
+		if (stored_length == raw_length) {
+			output(stored, raw_length);
+		} else if (lz_decompress(stored, stored_length, decoder.raw.data(), raw_length)) {
+			output(decoder.raw.data(), raw_length);
+		} else {
+			decoder.damaged = true;
+			break;
+		}
+		decoder.decoded += raw_length;
+		decoder.filled = 0;
+	}
+	return !decoder.damaged;
+}
+
+bool block_decoder_done(const BlockDecoder &decoder) {
+	return !decoder.damaged && decoder.filled == 0;
+}
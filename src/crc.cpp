@@ -0,0 +1,249 @@
+#include "../inc/crc.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include <cstring>
+
+using namespace std;
+
+const uint8_t crc8_table[256] = {
+    0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA, 0x7D, 0x4C, 0x1F, 0x2E,
+    0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4, 0xFA, 0xCB, 0x98, 0xA9, 0x3E, 0x0F, 0x5C, 0x6D,
+    0x86, 0xB7, 0xE4, 0xD5, 0x42, 0x73, 0x20, 0x11, 0x3F, 0x0E, 0x5D, 0x6C, 0xFB, 0xCA, 0x99, 0xA8,
+    0xC5, 0xF4, 0xA7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F, 0xB8, 0x89, 0xDA, 0xEB,
+    0x3D, 0x0C, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA, 0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13,
+    0x7E, 0x4F, 0x1C, 0x2D, 0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6, 0xA5, 0x94, 0x03, 0x32, 0x61, 0x50,
+    0xBB, 0x8A, 0xD9, 0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 0x02, 0x33, 0x60, 0x51, 0xC6, 0xF7, 0xA4, 0x95,
+    0xF8, 0xC9, 0x9A, 0xAB, 0x3C, 0x0D, 0x5E, 0x6F, 0x41, 0x70, 0x23, 0x12, 0x85, 0xB4, 0xE7, 0xD6,
+    0x7A, 0x4B, 0x18, 0x29, 0xBE, 0x8F, 0xDC, 0xED, 0xC3, 0xF2, 0xA1, 0x90, 0x07, 0x36, 0x65, 0x54,
+    0x39, 0x08, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80, 0xB1, 0xE2, 0xD3, 0x44, 0x75, 0x26, 0x17,
+    0xFC, 0xCD, 0x9E, 0xAF, 0x38, 0x09, 0x5A, 0x6B, 0x45, 0x74, 0x27, 0x16, 0x81, 0xB0, 0xE3, 0xD2,
+    0xBF, 0x8E, 0xDD, 0xEC, 0x7B, 0x4A, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xC2, 0xF3, 0xA0, 0x91,
+    0x47, 0x76, 0x25, 0x14, 0x83, 0xB2, 0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD, 0x3A, 0x0B, 0x58, 0x69,
+    0x04, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93, 0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A,
+    0xC1, 0xF0, 0xA3, 0x92, 0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF,
+    0x82, 0xB3, 0xE0, 0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0x0A, 0x59, 0x68, 0xFF, 0xCE, 0x9D, 0xAC
+};
+
+#define CRC32C_POLY 0x82F63B78	// reflected
+#define CRC32C_LONG 1024		// bytes per stream of the interleaved kernel, in 3 stream blocks
+#define CRC32C_SHORT 128
+
+// Slicing tables: crc8_slices[k] advances the crc over a byte followed by k more,
+// crc32c_slices[k] is the table of a byte k bytes ahead of the end of an 8 byte word
+struct CrcTables {
+	uint8_t crc8_slices[8][256];
+	uint32_t crc32c_slices[8][256];
+	uint32_t long_shifts[2];  // x^(8n-33) for n = CRC32C_LONG, 2 CRC32C_LONG
+	uint32_t short_shifts[2];
+
+	CrcTables();
+};
+
+// x^n mod P, as the interleaved kernel multiplies by it
+static uint32_t crc32c_power(size_t n) {
+	uint32_t power = 0x80000000;  // x^0
+	for (size_t i = 0; i < n; i++) {
+		power = (power >> 1) ^ ((power & 1) ? CRC32C_POLY : 0);
+	}
+	return power;
+}
+
+CrcTables::CrcTables() {
+	for (int n = 0; n < 256; n++) {
+		uint32_t crc = n;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+		}
+		crc32c_slices[0][n] = crc;
+		crc8_slices[0][n] = crc8_table[n];
+	}
+	for (int k = 1; k < 8; k++) {
+		for (int n = 0; n < 256; n++) {
+			crc8_slices[k][n] = crc8_table[crc8_slices[k - 1][n]];
+			uint32_t crc = crc32c_slices[k - 1][n];
+			crc32c_slices[k][n] = (crc >> 8) ^ crc32c_slices[0][crc & 0xFF];
+		}
+	}
+	long_shifts[0] = crc32c_power(8 * CRC32C_LONG - 33);
+	long_shifts[1] = crc32c_power(2 * 8 * CRC32C_LONG - 33);
+	short_shifts[0] = crc32c_power(8 * CRC32C_SHORT - 33);
+	short_shifts[1] = crc32c_power(2 * 8 * CRC32C_SHORT - 33);
+}
+
+static const CrcTables tables;
+
+
+uint8_t crc8(uint8_t crc, const uint8_t *data, size_t size) {
+	const auto &t = tables.crc8_slices;
+	for (; size >= 8; data += 8, size -= 8) {
+		crc = t[7][crc ^ data[0]] ^ t[6][data[1]] ^ t[5][data[2]] ^ t[4][data[3]] ^
+			  t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+	}
+	for (; size > 0; data++, size--) {
+		crc = crc8_table[crc ^ *data];
+	}
+	return crc;
+}
+
+
+// The kernels work on the raw register, crc32c() inverts it before and after
+typedef uint32_t (*Crc32cKernel)(uint32_t crc, const uint8_t *data, size_t size);
+
+static uint32_t crc32c_slicing(uint32_t crc, const uint8_t *data, size_t size) {
+	const auto &t = tables.crc32c_slices;
+	for (; size >= 8; data += 8, size -= 8) {
+		uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+		crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^
+			  t[4][low >> 24] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+	}
+	for (; size > 0; data++, size--) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc,
+															   const uint8_t *data,
+															   size_t size) {
+	uint64_t crc64 = crc;
+	for (; size >= 8; data += 8, size -= 8) {
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = crc64;
+	for (; size > 0; data++, size--) {
+		crc = _mm_crc32_u8(crc, *data);
+	}
+	return crc;
+}
+
+// crc * x^(8n) mod P, with shift = x^(8n-33): the product comes out reflected and one degree
+// up, and the crc32 instruction over it adds the other 32 while reducing
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crc32c_shift(uint32_t crc,
+																	   uint32_t shift) {
+	__m128i product =
+		_mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc), _mm_cvtsi32_si128((int)shift), 0);
+	return _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+// One crc32 instruction has three cycles of latency but issues every cycle, three independent
+// streams over consecutive thirds keep it busy, then get shifted into place and combined
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crc32c_blocks(
+	uint32_t crc, const uint8_t *&data, size_t &size, size_t stream, const uint32_t shifts[2]) {
+	for (; size >= 3 * stream; data += 3 * stream, size -= 3 * stream) {
+		uint64_t a = crc, b = 0, c = 0;
+		for (size_t i = 0; i < stream; i += 8) {
+			uint64_t words[3];
+			memcpy(&words[0], data + i, 8);
+			memcpy(&words[1], data + stream + i, 8);
+			memcpy(&words[2], data + 2 * stream + i, 8);
+			a = _mm_crc32_u64(a, words[0]);
+			b = _mm_crc32_u64(b, words[1]);
+			c = _mm_crc32_u64(c, words[2]);
+		}
+		crc = crc32c_shift(a, shifts[1]) ^ crc32c_shift(b, shifts[0]) ^ (uint32_t)c;
+	}
+	return crc;
+}
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crc32c_pclmul(uint32_t crc,
+																		const uint8_t *data,
+																		size_t size) {
+	crc = crc32c_blocks(crc, data, size, CRC32C_LONG, tables.long_shifts);
+	crc = crc32c_blocks(crc, data, size, CRC32C_SHORT, tables.short_shifts);
+	return crc32c_sse42(crc, data, size);
+}
+#endif
+
+struct Crc32cDispatch {
+	Crc32cKernel kernel;
+	const char *name;
+
+	Crc32cDispatch() : kernel(crc32c_slicing), name("slicing-by-8") {
+#if defined(__x86_64__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+			kernel = crc32c_pclmul;
+			name = "sse4.2 + pclmul, 3 streams";
+		} else if (__builtin_cpu_supports("sse4.2")) {
+			kernel = crc32c_sse42;
+			name = "sse4.2";
+		}
+#endif
+	}
+};
+
+static const Crc32cDispatch dispatch;
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t size) {
+	return ~dispatch.kernel(~crc, data, size);
+}
+
+// The register after one zero byte is x^8 times the one before, both crcs start from 0 and are
+// linear in it, so the crc over the zeros adds up with the data's own crc
+
+// a * b mod the crc8 polynomial, highest degree in the top bit
+static uint8_t crc8_multiply(uint8_t a, uint8_t b) {
+	uint8_t product = 0;
+	for (int bit = 7; bit >= 0; bit--) {
+		product = (product << 1) ^ ((product & 0x80) ? 0x31 : 0);
+		if (a & (1 << bit)) {
+			product ^= b;
+		}
+	}
+	return product;
+}
+
+// x^(8 size), squared up from x^8
+uint8_t crc8_zeros(size_t size) {
+	uint8_t power = 1;	// x^0
+	for (uint8_t square = crc8_table[1]; size > 0; size >>= 1) {
+		if (size & 1) {
+			power = crc8_multiply(power, square);
+		}
+		square = crc8_multiply(square, square);
+	}
+	return power;
+}
+
+uint8_t crc8_combine(uint8_t crc, uint8_t data_crc, uint8_t zeros) {
+	return crc8_multiply(crc, zeros) ^ data_crc;
+}
+
+// a * b mod P, reflected: x^0 in the top bit
+static uint32_t crc32c_multiply(uint32_t a, uint32_t b) {
+	uint32_t product = 0;
+	for (uint32_t bit = 0x80000000; bit != 0; bit >>= 1) {
+		if (a & bit) {
+			product ^= b;
+		}
+		b = (b >> 1) ^ ((b & 1) ? CRC32C_POLY : 0);
+	}
+	return product;
+}
+
+uint32_t crc32c_zeros(size_t size) {
+	uint32_t power = 0x80000000;  // x^0
+	for (uint32_t square = crc32c_power(8); size > 0; size >>= 1) {
+		if (size & 1) {
+			power = crc32c_multiply(power, square);
+		}
+		square = crc32c_multiply(square, square);
+	}
+	return power;
+}
+
+// the inversions before and after cancel out between the two crcs
+uint32_t crc32c_combine(uint32_t crc, uint32_t data_crc, uint32_t zeros) {
+	return crc32c_multiply(crc, zeros) ^ data_crc;
+}
+
+const char *crc32c_kernel() {
+	return dispatch.name;
+}
@@ -0,0 +1,204 @@
+#include "../inc/fec.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+// destination ^= source, a word at a time
+static void xor_bytes(uint8_t *destination, const uint8_t *source, size_t size) {
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t a, b;
+		memcpy(&a, destination + i, sizeof(a));
+		memcpy(&b, source + i, sizeof(b));
+		a ^= b;
+		memcpy(destination + i, &a, sizeof(a));
+	}
+	for (; i < size; i++) {
+		destination[i] ^= source[i];
+	}
+}
+
+// bytes of a parity payload, the FEC header and the XOR of the largest payload
+static size_t parity_size(const FecEncoder &fec) {
+	return FEC_HEADER_SIZE + fec.payload_size;
+}
+
+// payload of parity frame index in the pool
+static uint8_t *parity_payload(FecEncoder &fec, int index) {
+	return &fec.parity_payloads[index * parity_size(fec)];
+}
+
+void fec_encoder_init(FecEncoder &fec, uint16_t payload_size) {
+	fec.payload_size = payload_size;
+	fec.parity_count = 0;
+	fec.group_size = 0;
+	fec.group_start = 0;
+	fec.session = 0;
+	fec.parity.resize(FEC_PARITY_POOL);
+	fec.parity_payloads.resize(FEC_PARITY_POOL * parity_size(fec));
+	fec.length_xor.resize(FEC_PARITY_POOL);
+	fec.first_parity = 0;
+	fec.loss_rate = 0;
+	fec.sent = 0;
+	fec.lost = 0;
+}
+
+// twice the expected losses of a group, so most groups lose fewer frames than they can rebuild
+static int parity_for_loss(double loss_rate) {
+	if (loss_rate < FEC_MIN_LOSS) {
+		return 0;
+	}
+	return min(FEC_MAX_PARITY, (int)ceil(2 * loss_rate * FEC_GROUP_FRAMES));
+}
+
+static void start_group(FecEncoder &fec, TxBatch &batch, const FrameHeader &header) {
+	// the parities of the last group may still be queued, these go after them
+	fec.first_parity += fec.parity_count;
+
+	int parity_count = parity_for_loss(fec.loss_rate);
+	if (SHOW_LOGS == 1 && parity_count != fec.parity_count) {
+		cout << "FEC " << parity_count << " parity frames per " << FEC_GROUP_FRAMES
+			 << " (loss " << fec.loss_rate * 100 << "%)" << endl;
+	}
+	fec.parity_count = parity_count;
+	fec.group_start = header.sequence;
+	fec.session = header.session;
+
+	if (fec.first_parity + fec.parity_count > FEC_PARITY_POOL) {
+		flush_frames(batch);
+		fec.first_parity = 0;
+	}
+	for (int i = 0; i < fec.parity_count; i++) {
+		memset(parity_payload(fec, fec.first_parity + i), 0, parity_size(fec));
+		fec.parity[fec.first_parity + i].length = FEC_HEADER_SIZE;
+		fec.length_xor[fec.first_parity + i] = 0;
+	}
+}
+
+void fec_add(FecEncoder &fec, TxBatch &batch, const FrameHeader &header, const uint8_t *payload,
+			 FrameFormat format) {
+	if (fec.group_size == 0) {
+		start_group(fec, batch, header);
+	}
+	fec.sent++;
+
+	if (fec.parity_count > 0) {
+		int index = fec.first_parity + fec.group_size % fec.parity_count;
+		FrameHeader &parity = fec.parity[index];
+		xor_bytes(parity_payload(fec, index) + FEC_HEADER_SIZE, payload, header.length);
+		parity.length = max<uint16_t>(parity.length, FEC_HEADER_SIZE + header.length);
+		fec.length_xor[index] ^= header.length;
+	}
+
+	fec.group_size++;
+	if (fec.group_size == FEC_GROUP_FRAMES) {
+		fec_finish(fec, batch, format);
+	}
+}
+
+void fec_finish(FecEncoder &fec, TxBatch &batch, FrameFormat format) {
+	if (fec.group_size == 0) {
+		return;
+	}
+
+	for (int i = 0; i < fec.parity_count && i < fec.group_size; i++) {
+		FrameHeader &parity = fec.parity[fec.first_parity + i];
+		uint8_t *payload = parity_payload(fec, fec.first_parity + i);
+		uint16_t length_xor = fec.length_xor[fec.first_parity + i];
+		parity.start_marker = START_MARKER;
+		parity.type = TYPE_PARITY;
+		parity.session = fec.session;
+		parity.sequence = fec.group_start;
+		payload[0] = i;
+		payload[1] = fec.parity_count;
+		payload[2] = fec.group_size;
+		payload[3] = length_xor >> 8;
+		payload[4] = length_xor & 0xFF;
+		parity.crc = calculate_crc(parity, payload);
+		queue_frame(batch, parity, payload, format);
+	}
+
+	double sample = min(1.0, (double)fec.lost / fec.sent);
+	fec.loss_rate += (sample - fec.loss_rate) / 8;
+	fec.sent = 0;
+	fec.lost = 0;
+	fec.group_size = 0;
+}
+
+void fec_on_loss(FecEncoder &fec, int frames) {
+	fec.lost += frames;
+}
+
+
+void fec_decoder_init(FecDecoder &fec, uint16_t payload_size) {
+	fec.payload_size = payload_size;
+	fec.payloads.resize(FEC_HISTORY * payload_size);
+	fec.sequences.assign(FEC_HISTORY, -1);
+	fec.lengths.resize(FEC_HISTORY);
+	fec.rebuilt.resize(LARGE_HEADER_SIZE + payload_size);
+}
+
+void fec_remember(FecDecoder &fec, const Frame &data) {
+	if (data.length > fec.payload_size) {
+		return;
+	}
+	int slot = data.sequence % FEC_HISTORY;
+	memcpy(&fec.payloads[slot * fec.payload_size], data.data, data.length);
+	fec.sequences[slot] = data.sequence;
+	fec.lengths[slot] = data.length;
+}
+
+const Frame *fec_recover(FecDecoder &fec, const Frame &parity) {
+	if (parity.length < FEC_HEADER_SIZE || parity.length > FEC_HEADER_SIZE + fec.payload_size) {
+		return nullptr;
+	}
+	int index = parity.data[0];
+	int count = parity.data[1];
+	int group_size = parity.data[2];
+	uint16_t length = parity.data[3] << 8 | parity.data[4];
+	if (count == 0 || index >= count || group_size > FEC_GROUP_FRAMES) {
+		return nullptr;
+	}
+
+	int missing = -1;
+	for (int member = index; member < group_size; member += count) {
+		uint16_t sequence = (parity.sequence + member) % MAX_SEQ;
+		if (fec.sequences[sequence % FEC_HISTORY] != sequence) {
+			if (missing >= 0) {
+				return nullptr;
+			}
+			missing = sequence;
+		}
+	}
+	if (missing < 0) {
+		return nullptr;
+	}
+
+	// parity XOR every other frame of the class is the missing one
+	Frame &rebuilt = *reinterpret_cast<Frame *>(fec.rebuilt.data());
+	uint16_t size = parity.length - FEC_HEADER_SIZE;
+	memcpy(rebuilt.data, parity.data + FEC_HEADER_SIZE, size);
+	for (int member = index; member < group_size; member += count) {
+		uint16_t sequence = (parity.sequence + member) % MAX_SEQ;
+		if (sequence != missing) {
+			int slot = sequence % FEC_HISTORY;
+			xor_bytes(rebuilt.data, &fec.payloads[slot * fec.payload_size],
+					  min(size, fec.lengths[slot]));
+			length ^= fec.lengths[slot];
+		}
+	}
+	if (length > size) {
+		return nullptr;
+	}
+
+	rebuilt.start_marker = START_MARKER;
+	rebuilt.type = TYPE_DATA;
+	rebuilt.session = parity.session;
+	rebuilt.sequence = missing;
+	rebuilt.length = length;
+	rebuilt.crc = CRC_INTACT;
+	return &rebuilt;
+}
@@ -0,0 +1,81 @@
+#include "../inc/file-source.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+bool file_source_open(FileSource &source, const string &path, uint64_t offset, uint64_t length) {
+	source.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (source.fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(source.fd, &info) < 0 || !S_ISREG(info.st_mode) || offset > (uint64_t)info.st_size) {
+		close(source.fd);
+		return false;
+	}
+	source.size = info.st_size - offset;
+	if (length > 0) {
+		source.size = min<uint64_t>(source.size, length);
+	}
+	source.data = nullptr;
+	source.prefetched = 0;
+	source.mapping = nullptr;
+	source.mapped_size = 0;
+
+	// an empty range has nothing to map, it is sent as a lone END_TX
+	if (source.size == 0) {
+		return true;
+	}
+
+	// the mapping can only start on a page, the range is read from wherever in it it starts
+	size_t page = sysconf(_SC_PAGESIZE);
+	uint64_t start = offset / page * page;
+	source.mapped_size = source.size + (offset - start);
+	source.mapping = mmap(nullptr, source.mapped_size, PROT_READ, MAP_SHARED, source.fd, start);
+	if (source.mapping == MAP_FAILED) {
+		close(source.fd);
+		return false;
+	}
+	source.data = (const uint8_t *)source.mapping + (offset - start);
+	madvise(source.mapping, source.mapped_size, MADV_SEQUENTIAL);
+	posix_fadvise(source.fd, offset, source.size, POSIX_FADV_SEQUENTIAL);
+	file_source_prefetch(source, 0);
+	return true;
+}
+
+void file_source_memory(FileSource &source, const uint8_t *data, size_t size) {
+	source.fd = -1;
+	source.data = data;
+	source.size = size;
+	source.prefetched = size;  // nothing to read ahead
+	source.mapping = nullptr;
+	source.mapped_size = 0;
+}
+
+void file_source_prefetch(FileSource &source, size_t offset) {
+	// asked for in READAHEAD_BYTES steps, not once per frame
+	if (source.prefetched >= source.size || offset + READAHEAD_BYTES / 2 < source.prefetched) {
+		return;
+	}
+
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)(source.data + source.prefetched) / page * page;
+	size_t end = min(offset + READAHEAD_BYTES, source.size);
+	madvise((void *)start, (uintptr_t)(source.data + end) - start, MADV_WILLNEED);
+	source.prefetched = end;
+}
+
+void file_source_close(FileSource &source) {
+	if (source.fd < 0) {
+		return;
+	}
+	if (source.mapping != nullptr) {
+		munmap(source.mapping, source.mapped_size);
+	}
+	close(source.fd);
+}
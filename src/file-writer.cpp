@@ -0,0 +1,150 @@
+#include "../inc/file-writer.h"
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void signal_event(int fd) {
+	uint64_t one = 1;
+	if (write(fd, &one, sizeof(one)) < 0) {
+		// the counter is already set
+	}
+}
+
+static void wait_event(int fd) {
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0) {
+		// interrupted, the caller looks again
+	}
+}
+
+static void run_writer(FileWriter &writer) {
+	while (true) {
+		WriteJob *job = spsc_front(writer.jobs);
+		if (job == nullptr) {
+			if (writer.closing) {
+				return;
+			}
+			// say we wait before the last look, a commit after it is then sure to signal
+			writer.writer_waiting = true;
+			if (spsc_front(writer.jobs) == nullptr && !writer.closing) {
+				wait_event(writer.ready_fd);
+			}
+			continue;
+		}
+
+		size_t written = 0;
+		while (written < job->length) {
+			ssize_t result =
+				writer.sequential
+					? write(writer.fd, job->data + written, job->length - written)
+					: pwrite(writer.fd, job->data + written, job->length - written, job->offset + written);
+			if (result <= 0) {
+				writer.failed = true;
+				break;
+			}
+			written += result;
+		}
+		spsc_release(writer.jobs);
+
+		if (writer.receiver_waiting && writer.receiver_waiting.exchange(false)) {
+			signal_event(writer.space_fd);
+		}
+	}
+}
+
+static void start_writer(FileWriter &writer, int fd, uint16_t chunk_size, size_t slots,
+						 bool sequential) {
+	writer.fd = fd;
+	spsc_init(writer.jobs, slots);
+	writer.buffers.resize(writer.jobs.items.size() * chunk_size);
+	for (size_t i = 0; i < writer.jobs.items.size(); i++) {
+		writer.jobs.items[i].data = writer.buffers.data() + i * chunk_size;
+	}
+	writer.end = 0;
+	writer.ready_fd = eventfd(0, EFD_CLOEXEC);
+	writer.space_fd = eventfd(0, EFD_CLOEXEC);
+	if (writer.ready_fd < 0 || writer.space_fd < 0) {
+		perror("Failed to create writer events");
+		exit(EXIT_FAILURE);
+	}
+	writer.writer_waiting = false;
+	writer.receiver_waiting = false;
+	writer.closing = false;
+	writer.failed = false;
+	writer.sequential = sequential;
+	writer.first_write_us = 0;
+	writer.writer = thread(run_writer, ref(writer));
+}
+
+bool file_writer_open(FileWriter &writer, const string &path, uint64_t size, uint16_t chunk_size,
+					  bool keep) {
+	int fd = open(path.c_str(), O_CREAT | (keep ? 0 : O_TRUNC) | O_WRONLY | O_CLOEXEC, 0644);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) < 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+	// reserved up front so the file is not grown block by block, and a full disk shows now
+	if (size > 0 && fallocate(fd, 0, 0, size) < 0 && errno != EOPNOTSUPP) {
+		perror("Failed to preallocate file");
+	}
+
+	start_writer(writer, fd, chunk_size, WRITER_SLOTS, false);
+	// kept bytes are not trimmed away on close, nor what other writers may still fill in
+	writer.end = keep ? max<uint64_t>(info.st_size, size) : 0;
+	return true;
+}
+
+void file_writer_stream(FileWriter &writer, int fd, uint16_t chunk_size, size_t slots) {
+	start_writer(writer, fd, chunk_size, slots, true);
+}
+
+void file_writer_write(FileWriter &writer, uint64_t offset, const uint8_t *data, uint16_t length) {
+	WriteJob *job;
+	while ((job = spsc_reserve(writer.jobs)) == nullptr) {
+		// every slot is pending, the disk is far behind the network
+		writer.receiver_waiting = true;
+		if ((job = spsc_reserve(writer.jobs)) != nullptr) {
+			break;
+		}
+		wait_event(writer.space_fd);
+	}
+
+	job->offset = offset;
+	job->length = length;
+	memcpy(job->data, data, length);
+	spsc_commit(writer.jobs);
+	writer.end = max<uint64_t>(writer.end, offset + length);
+	if (writer.first_write_us == 0) {
+		writer.first_write_us = now_us();
+	}
+
+	if (writer.writer_waiting && writer.writer_waiting.exchange(false)) {
+		signal_event(writer.ready_fd);
+	}
+}
+
+bool file_writer_close(FileWriter &writer) {
+	writer.closing = true;
+	signal_event(writer.ready_fd);
+	writer.writer.join();
+
+	// the reservation may be larger than what arrived
+	if (!writer.sequential && ftruncate(writer.fd, writer.end) < 0) {
+		writer.failed = true;
+	}
+	close(writer.fd);
+	close(writer.ready_fd);
+	close(writer.space_fd);
+	return !writer.failed;
+}
@@ -0,0 +1,323 @@
+#include "../inc/frame-cache.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+#include "../inc/compress.h"
+#include "../inc/file-source.h"
+#include "../inc/metrics.h"
+
+#define CACHE_SKETCH_ROWS 4
+#define CACHE_SKETCH_BITS 12  // counters a row, as a power of two
+#define CACHE_SKETCH_MAX 15
+#define CACHE_SKETCH_SAMPLE (10 << CACHE_SKETCH_BITS)  // requests after which counters are halved
+#define CACHE_ADMIT_REQUESTS 2	// a file is read in once it was asked for this often lately
+#define CACHE_FILLER_NICE 10	// reading in waits for the transfers, it only makes later ones faster
+
+// the name goes last, nothing it holds can make two keys the same
+static string entry_key(const string &name, uint16_t payload_size, bool compressed) {
+	return to_string(payload_size) + (compressed ? "z " : " ") + name;
+}
+
+static int64_t mtime_ns(const struct stat &info) {
+	return info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+static size_t sketch_counter(const string &name, int row) {
+	uint64_t mixed = (hash<string>()(name) + row * 0x9E3779B97F4A7C15ULL) * 0xBF58476D1CE4E5B9ULL;
+	return ((size_t)row << CACHE_SKETCH_BITS) + (mixed >> (64 - CACHE_SKETCH_BITS));
+}
+
+static int sketch_estimate(const FrameCache &cache, const string &name) {
+	int estimate = CACHE_SKETCH_MAX;
+	for (int row = 0; row < CACHE_SKETCH_ROWS; row++) {
+		estimate = min<int>(estimate, cache.sketch[sketch_counter(name, row)]);
+	}
+	return estimate;
+}
+
+// Only the smallest counters of the file go up, a file that shares the others with a popular
+// one isn't counted as popular too. Halving them every so often lets old popularity fade
+static void sketch_add(FrameCache &cache, const string &name) {
+	int estimate = sketch_estimate(cache, name);
+	for (int row = 0; row < CACHE_SKETCH_ROWS && estimate < CACHE_SKETCH_MAX; row++) {
+		uint8_t &counter = cache.sketch[sketch_counter(name, row)];
+		if (counter == estimate) {
+			counter++;
+		}
+	}
+	if (++cache.sketch_additions == CACHE_SKETCH_SAMPLE) {
+		for (uint8_t &counter : cache.sketch) {
+			counter /= 2;
+		}
+		cache.sketch_additions = 0;
+	}
+}
+
+// The file as a transfer with these frames sends it, nullptr if it can't be read
+static shared_ptr<CachedFile> read_in(const FrameCache &cache, const CacheFill &fill) {
+	FileSource file;
+	struct stat info;
+	if (!file_source_open(file, cache.directory + "/" + fill.name, 0, 0)) {
+		return nullptr;
+	}
+	if (fstat(file.fd, &info) < 0) {
+		file_source_close(file);
+		return nullptr;
+	}
+
+	shared_ptr<CachedFile> entry = make_shared<CachedFile>();
+	entry->name = fill.name;
+	entry->payload_size = fill.payload_size;
+	// the way worth_compressing decides a whole file, a compressed fill was decided so already
+	entry->compressible =
+		fill.compressed || compress_sample(file.data, file.size) <= COMPRESS_MAX_RATIO;
+	entry->compressed = fill.compressed || (fill.warm && USE_COMPRESSION && entry->compressible);
+	entry->file_size = info.st_size;
+	entry->mtime_ns = mtime_ns(info);
+
+	if (entry->compressed) {
+		// the same blocks the compressing producer makes, run on from frame to frame
+		vector<uint8_t> block(COMPRESS_BLOCK_HEADER + COMPRESS_BLOCK_BYTES);
+		for (size_t offset = 0; offset < file.size; offset += COMPRESS_BLOCK_BYTES) {
+			size_t raw = min<size_t>(COMPRESS_BLOCK_BYTES, file.size - offset);
+			size_t stored = compress_block(file.data + offset, raw, block.data());
+			entry->bytes.insert(entry->bytes.end(), block.begin(), block.begin() + stored);
+			file_source_prefetch(file, offset + raw);
+		}
+		entry->bytes.shrink_to_fit();
+	} else {
+		entry->bytes.assign(file.data, file.data + file.size);
+	}
+	file_source_close(file);
+
+	size_t size = entry->bytes.size();
+	entry->frames.reserve((size + fill.payload_size - 1) / fill.payload_size);
+	for (size_t offset = 0; offset < size; offset += fill.payload_size) {
+		uint16_t length = min<size_t>(fill.payload_size, size - offset);
+		const PayloadCrc *previous = entry->frames.empty() ? nullptr : &entry->frames.back();
+		entry->frames.push_back(payload_crc(entry->bytes.data() + offset, length, previous));
+	}
+	entry->memory = sizeof(CachedFile) + entry->name.size() + entry->bytes.capacity() +
+					entry->frames.capacity() * sizeof(PayloadCrc);
+	return entry;
+}
+
+static void drop(FrameCache &cache, size_t slot) {
+	const CachedFile &file = *cache.slots[slot].file;
+	cache.index.erase(entry_key(file.name, file.payload_size, file.compressed));
+	cache.used -= file.memory;
+	cache_metrics.bytes.fetch_sub(file.memory, memory_order_relaxed);
+	cache_metrics.files.fetch_sub(1, memory_order_relaxed);
+	cache.slots[slot].file.reset();
+}
+
+// The hand picks the entries to push out for entry, clearing the referenced bits it passes,
+// and entry only goes in when it was asked for more often than each of them. A warm entry
+// always goes in
+static void admit(FrameCache &cache, const shared_ptr<const CachedFile> &entry, bool warm) {
+	string key = entry_key(entry->name, entry->payload_size, entry->compressed);
+	auto existing = cache.index.find(key);
+	if (existing != cache.index.end()) {
+		drop(cache, existing->second);
+	}
+	if (entry->memory > cache.capacity) {
+		return;
+	}
+
+	int frequency = sketch_estimate(cache, entry->name);
+	vector<size_t> victims;
+	size_t freed = 0;
+	// twice round at most, every bit is clear the second time
+	for (size_t step = 0; cache.used - freed + entry->memory > cache.capacity &&
+						  step < 2 * cache.slots.size();
+		 step++) {
+		size_t slot = cache.hand;
+		cache.hand = (cache.hand + 1) % cache.slots.size();
+		const CacheSlot &candidate = cache.slots[slot];
+		if (candidate.file == nullptr ||
+			find(victims.begin(), victims.end(), slot) != victims.end()) {
+			continue;
+		}
+		if (candidate.referenced) {
+			cache.slots[slot].referenced = false;
+			continue;
+		}
+		if (!warm && sketch_estimate(cache, candidate.file->name) >= frequency) {
+			return;
+		}
+		victims.push_back(slot);
+		freed += candidate.file->memory;
+	}
+	if (cache.used - freed + entry->memory > cache.capacity) {
+		return;
+	}
+	for (size_t slot : victims) {
+		drop(cache, slot);
+		metric_add(cache_metrics.evictions);
+	}
+
+	size_t slot = 0;
+	while (slot < cache.slots.size() && cache.slots[slot].file != nullptr) {
+		slot++;
+	}
+	if (slot == cache.slots.size()) {
+		cache.slots.push_back(CacheSlot());
+	}
+	cache.slots[slot].file = entry;
+	cache.slots[slot].referenced = false;
+	cache.index[key] = slot;
+	cache.used += entry->memory;
+	metric_add(cache_metrics.bytes, entry->memory);
+	metric_add(cache_metrics.files);
+	if (SHOW_LOGS == 1) {
+		cout << "Cached " << entry->name << " (" << entry->frames.size() << " frames of "
+			 << entry->payload_size << (entry->compressed ? " bytes, compressed)" : " bytes)")
+			 << endl;
+	}
+}
+
+static void queue_fill(FrameCache &cache, const CacheFill &fill) {
+	if (cache.pending.insert(entry_key(fill.name, fill.payload_size, fill.compressed)).second) {
+		cache.fills.push_back(fill);
+		cache.wake.notify_one();
+	}
+}
+
+static void run_filler(FrameCache &cache) {
+	// for this thread only, Linux gives every thread a nice value of its own
+	if (setpriority(PRIO_PROCESS, gettid(), CACHE_FILLER_NICE) < 0) {
+		perror("Failed to lower cache filler priority");
+	}
+	unique_lock<mutex> guard(cache.lock);
+	while (true) {
+		cache.wake.wait(guard, [&]() { return cache.closing || !cache.fills.empty(); });
+		if (cache.closing) {
+			return;
+		}
+		CacheFill fill = cache.fills.front();
+		cache.fills.pop_front();
+
+		guard.unlock();
+		shared_ptr<CachedFile> entry = read_in(cache, fill);
+		guard.lock();
+		cache.pending.erase(entry_key(fill.name, fill.payload_size, fill.compressed));
+		if (entry != nullptr) {
+			admit(cache, entry, fill.warm);
+		}
+	}
+}
+
+void frame_cache_open(FrameCache &cache, const string &directory, size_t capacity) {
+	cache.directory = directory;
+	cache.capacity = capacity;
+	cache.slots.clear();
+	cache.hand = 0;
+	cache.used = 0;
+	cache.index.clear();
+	cache.sketch.assign(CACHE_SKETCH_ROWS << CACHE_SKETCH_BITS, 0);
+	cache.sketch_additions = 0;
+	cache.fills.clear();
+	cache.pending.clear();
+	cache.closing = false;
+	if (capacity > 0) {
+		metric_add(cache_metrics.capacity, capacity);
+		cache.filler = thread(run_filler, ref(cache));
+	}
+}
+
+void frame_cache_warm(FrameCache &cache, const string &list_path, uint16_t payload_size) {
+	if (cache.capacity == 0) {
+		return;
+	}
+	ifstream list(list_path);
+	string name;
+	while (getline(list, name)) {
+		if (!name.empty()) {
+			lock_guard<mutex> guard(cache.lock);
+			queue_fill(cache, CacheFill{name, payload_size, false, true});
+		}
+	}
+}
+
+shared_ptr<const CachedFile> frame_cache_find(FrameCache &cache, const string &name,
+											  uint16_t payload_size, bool compressed) {
+	if (cache.capacity == 0) {
+		return nullptr;
+	}
+	struct stat info;
+	bool exists = stat((cache.directory + "/" + name).c_str(), &info) == 0 && S_ISREG(info.st_mode);
+
+	lock_guard<mutex> guard(cache.lock);
+	sketch_add(cache, name);
+	auto entry = cache.index.find(entry_key(name, payload_size, compressed));
+	if (entry != cache.index.end()) {
+		CacheSlot &slot = cache.slots[entry->second];
+		// a file that changed since it was read in is read again
+		if (exists && slot.file->file_size == (uint64_t)info.st_size &&
+			slot.file->mtime_ns == mtime_ns(info)) {
+			slot.referenced = true;
+			metric_add(cache_metrics.hits);
+			return slot.file;
+		}
+		drop(cache, entry->second);
+	}
+
+	metric_add(cache_metrics.misses);
+	if (exists && (uint64_t)info.st_size <= cache.capacity &&
+		sketch_estimate(cache, name) >= CACHE_ADMIT_REQUESTS) {
+		queue_fill(cache, CacheFill{name, payload_size, compressed, false});
+	}
+	return nullptr;
+}
+
+bool frame_cache_compressible(FrameCache &cache, const string &name, uint16_t payload_size,
+							  bool &compressible) {
+	if (cache.capacity == 0) {
+		return false;
+	}
+	struct stat info;
+	if (stat((cache.directory + "/" + name).c_str(), &info) < 0) {
+		return false;
+	}
+
+	lock_guard<mutex> guard(cache.lock);
+	for (bool compressed : {true, false}) {
+		auto entry = cache.index.find(entry_key(name, payload_size, compressed));
+		if (entry == cache.index.end()) {
+			continue;
+		}
+		const CachedFile &file = *cache.slots[entry->second].file;
+		if (file.file_size == (uint64_t)info.st_size && file.mtime_ns == mtime_ns(info)) {
+			compressible = file.compressible;
+			return true;
+		}
+	}
+	return false;
+}
+
+void frame_cache_close(FrameCache &cache) {
+	if (cache.capacity == 0) {
+		return;
+	}
+	{
+		lock_guard<mutex> guard(cache.lock);
+		cache.closing = true;
+	}
+	cache.wake.notify_one();
+	cache.filler.join();
+
+	for (size_t slot = 0; slot < cache.slots.size(); slot++) {
+		if (cache.slots[slot].file != nullptr) {
+			drop(cache, slot);
+		}
+	}
+	cache_metrics.capacity.fetch_sub(cache.capacity, memory_order_relaxed);
+}
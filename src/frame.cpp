@@ -8,6 +8,8 @@ string translate_frame_type(uint8_t type) {
 			return "ACK";
 		case TYPE_NACK:
 			return "NACK";
+		case TYPE_SACK:
+			return "SACK";
 		case TYPE_LIST:
 			return "LIST";
 		case TYPE_DOWNLOAD:
@@ -18,6 +20,8 @@ string translate_frame_type(uint8_t type) {
 			return "FILE DESCRIPTOR";
 		case TYPE_DATA:
 			return "DATA";
+		case TYPE_PARITY:
+			return "PARITY";
 		case TYPE_END_TX:
 			return "END TX";
 		case TYPE_ERROR:
@@ -27,115 +31,261 @@ string translate_frame_type(uint8_t type) {
 	}
 }
 
-uint32_t calculate_crc8(const uint8_t* buf, size_t size) {
-    uint8_t crc8 = 0;
+static inline void put_le16(uint8_t *wire, uint16_t value) {
+	wire[0] = value & 0xFF;
+	wire[1] = value >> 8;
+}
+
+static inline uint16_t get_le16(const uint8_t *wire) {
+	return wire[0] | wire[1] << 8;
+}
 
-    for (size_t i = 0; i < size; i++) {
-        crc8 = crc8_table[crc8 ^ buf[i]];
-    }
+// Large wire header without the tags, crc byte included
+static void encode_header(const FrameHeader &header, uint8_t *wire) {
+	wire[0] = header.start_marker;
+	wire[WIRE_TYPE_OFFSET] = header.type;
+	put_le16(wire + WIRE_SESSION_OFFSET, header.session);
+	put_le16(wire + WIRE_SEQUENCE_OFFSET, header.sequence);
+	put_le16(wire + WIRE_LENGTH_OFFSET, header.length);
+	wire[WIRE_CRC_OFFSET] = header.crc;
+}
 
-    return crc8;
+// covers the wire header up to the crc, without tags, and the payload bytes actually present
+uint8_t calculate_crc(const FrameHeader &header, const uint8_t *payload) {
+	uint8_t wire[LARGE_HEADER_SIZE];
+	encode_header(header, wire);
+	return crc8(crc8(0, wire, WIRE_CRC_OFFSET), payload, header.length);
+}
+
+uint8_t calculate_crc(const FrameHeader &header, const PayloadCrc &payload) {
+	uint8_t wire[LARGE_HEADER_SIZE];
+	encode_header(header, wire);
+	return crc8_combine(crc8(0, wire, WIRE_CRC_OFFSET), payload.crc8, payload.crc8_zeros);
+}
+
+PayloadCrc payload_crc(const uint8_t *payload, uint16_t length, const PayloadCrc *previous) {
+	PayloadCrc checksums;
+	checksums.crc32c = crc32c(0, payload, length);
+	checksums.length = length;
+	checksums.crc8 = crc8(0, payload, length);
+	if (previous != nullptr && previous->length == length) {
+		checksums.crc32c_zeros = previous->crc32c_zeros;
+		checksums.crc8_zeros = previous->crc8_zeros;
+	} else {
+		checksums.crc32c_zeros = crc32c_zeros(length);
+		checksums.crc8_zeros = crc8_zeros(length);
+	}
+	return checksums;
 }
 
 uint8_t calculate_crc(const Frame &frame) {
-	uint8_t buffer[sizeof(frame) - sizeof(frame.crc)];
-	std::memcpy(buffer, &frame, sizeof(buffer));
-	
-	return calculate_crc8(buffer, sizeof(buffer));
-}
-
-
-// Send a frame until gets ack
-void send_frame_and_receive_ack(int sockfd, Frame &frame, int timeout_seconds) {
-	send(sockfd, (void*) &frame, sizeof(frame), 0);
-
-	Frame response;
-	while (true) {
-		bool received = receive_frame_with_timeout(sockfd, response, timeout_seconds);
-
-		if (!received) {
-			send(sockfd, (void*) &frame, sizeof(frame), 0);
-			if (SHOW_LOGS == 1) cout << "Timed out, resending frame " << (int)frame.sequence << " (" << translate_frame_type(frame.type) << ")"
-		 	<< endl;
-		} else if((response.type == TYPE_NACK && response.sequence == frame.sequence)) {
-			send(sockfd, (void*) &frame, sizeof(frame), 0);
-			if (SHOW_LOGS == 1) cout << "Resending frame " << (int)frame.sequence << " (" << translate_frame_type(frame.type) << ")"
-		 	<< endl;
-		} else if (response.type == TYPE_ACK && response.sequence == frame.sequence) {
-			return;
-		}
+	return calculate_crc(frame_header(frame), frame.data);
+}
+
+bool frame_intact(const Frame &frame) {
+	return frame.crc == CRC_INTACT;
+}
+
+FrameHeader frame_header(const Frame &frame) {
+	FrameHeader header;
+	memcpy(&header, &frame, sizeof(header));
+	return header;
+}
+
+// legacy peers check every byte before the crc, unused payload included
+static uint8_t calculate_legacy_crc(const uint8_t *legacy) {
+	return crc8(0, legacy, LEGACY_CRC_OFFSET);
+}
+
+int seq_offset(uint16_t base, uint16_t sequence) {
+	return (sequence - base + MAX_SEQ) % MAX_SEQ;
+}
+
+
+// the kernel adds the ethernet header, the whole MTU is ours
+uint16_t max_payload_for_mtu(int mtu) {
+	int payload = mtu - (int)LARGE_HEADER_SIZE;
+	payload = min(payload, MAX_FRAME_DATA_SIZE);
+	return max(payload, FRAME_DATA_SIZE);
+}
+
+
+// Builds the wire form of frame: header (a whole legacy frame in legacy format) goes to
+// header, the payload is referenced, not copied. Returns how many iovecs were filled.
+// A CRC-32C over the payload is only computed when checksums doesn't hold it already
+static int encode_frame(const FrameHeader &frame, const uint8_t *payload,
+						const PayloadCrc *checksums, FrameFormat format, uint8_t *header,
+						struct iovec iov[FRAME_IOVECS]) {
+	if (format == FORMAT_LEGACY) {
+		uint16_t length = min<uint16_t>(frame.length, FRAME_DATA_SIZE);
+		header[0] = frame.start_marker;
+		header[LEGACY_LENGTH_OFFSET] = length & LEGACY_LENGTH_MASK;
+		put_le16(header + LEGACY_SEQUENCE_OFFSET, frame.sequence);
+		header[LEGACY_TYPE_OFFSET] = frame.type & LEGACY_TYPE_MASK;
+		memcpy(header + LEGACY_DATA_OFFSET, payload, length);
+		// unused payload, crc and padding
+		memset(header + LEGACY_DATA_OFFSET + length, 0,
+			   LEGACY_FRAME_SIZE - LEGACY_DATA_OFFSET - length);
+		header[LEGACY_CRC_OFFSET] = calculate_legacy_crc(header);
+
+		iov[0].iov_base = header;
+		iov[0].iov_len = LEGACY_FRAME_SIZE;
+		return 1;
+	}
+
+	encode_header(frame, header);
+	header[WIRE_TYPE_OFFSET] |= LARGE_FRAME_TAG;
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = LARGE_HEADER_SIZE;
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = frame.length;
+	if (format == FORMAT_LARGE) {
+		return 2;
+	}
+
+	// the CRC-32C goes in the spare room after the header
+	header[WIRE_TYPE_OFFSET] |= CRC32C_FRAME_TAG;
+	header[WIRE_CRC_OFFSET] = 0;
+	uint32_t crc = crc32c(0, header, LARGE_HEADER_SIZE);
+	if (checksums != nullptr) {
+		crc = crc32c_combine(crc, checksums->crc32c, checksums->crc32c_zeros);
+	} else {
+		crc = crc32c(crc, payload, frame.length);
 	}
+	crc = htonl(crc);
+	memcpy(header + LARGE_HEADER_SIZE, &crc, sizeof(crc));
+	iov[2].iov_base = header + LARGE_HEADER_SIZE;
+	iov[2].iov_len = CRC32C_SIZE;
+	return 3;
 }
 
+void send_frame(int sockfd, const Frame &frame, FrameFormat format) {
+	uint8_t header[MAX_WIRE_HEADER_SIZE];
+	struct iovec iov[FRAME_IOVECS];
 
-// used for receiving acks and nacks
-bool receive_frame_with_timeout(int sockfd, Frame &frame, int timeout_seconds) {
-	auto start = chrono::steady_clock::now();
+	struct mmsghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_hdr.msg_name = (void *)transport_peer(sockfd);
+	message.msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+	message.msg_hdr.msg_iov = iov;
+	message.msg_hdr.msg_iovlen =
+		encode_frame(frame_header(frame), frame.data, nullptr, format, header, iov);
+	transport_send_batch(sockfd, &message, 1);
+}
 
-	while (true) {
-		ssize_t len = recv(sockfd, (void*) &frame, sizeof(Frame), 0);
 
-		if (len > 0) {
-			// Received a package, check if it is what was expected
-			if (frame.start_marker == START_MARKER) {
-				return true;
-			}
-		}
+void tx_batch_init(TxBatch &batch, int sockfd) {
+	batch.sockfd = sockfd;
+	batch.count = 0;
+	batch.headers.resize(TX_BATCH_SIZE * MAX_WIRE_HEADER_SIZE);
+	batch.iovecs.resize(TX_BATCH_SIZE * FRAME_IOVECS);
+	batch.messages.resize(TX_BATCH_SIZE);
+}
 
-		auto now = chrono::steady_clock::now();
-		auto elapsed_seconds = chrono::duration_cast<chrono::seconds>(now - start).count();
-		// Timout
-		if (elapsed_seconds >= timeout_seconds) {
-			return false;
-		}
+void queue_frame(TxBatch &batch, const Frame &frame, FrameFormat format) {
+	queue_frame(batch, frame_header(frame), frame.data, format);
+}
+
+void queue_frame(TxBatch &batch, const FrameHeader &header, const uint8_t *payload,
+				 FrameFormat format) {
+	queue_frame(batch, header, payload, nullptr, format);
+}
+
+void queue_frame(TxBatch &batch, const FrameHeader &header, const uint8_t *payload,
+				 const PayloadCrc *checksums, FrameFormat format) {
+	if (batch.count == TX_BATCH_SIZE) {
+		flush_frames(batch);
+	}
+
+	unsigned int i = batch.count++;
+	struct iovec *iov = &batch.iovecs[i * FRAME_IOVECS];
+	struct mmsghdr &message = batch.messages[i];
+	memset(&message, 0, sizeof(message));
+	message.msg_hdr.msg_name = (void *)transport_peer(batch.sockfd);
+	message.msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+	message.msg_hdr.msg_iov = iov;
+	message.msg_hdr.msg_iovlen = encode_frame(header, payload, checksums, format,
+											  &batch.headers[i * MAX_WIRE_HEADER_SIZE], iov);
+}
+
+void flush_frames(TxBatch &batch) {
+	if (batch.count > 0) {
+		transport_send_batch(batch.sockfd, batch.messages.data(), batch.count);
+		batch.count = 0;
 	}
 }
 
 
-// receive a frame until its right and send ack
-void receive_frame_and_send_ack(int sockfd, uint8_t seq, Frame &frame) {
-	random_device rd;
-	mt19937 gen(rd());
-	uniform_int_distribution<> dist(1, ERRORS_FREQ_LIST);
+const Frame *receive_frame_view(int sockfd, int64_t timeout_us) {
+	uint8_t *packet;
+	ssize_t len = transport_receive(sockfd, &packet, timeout_us);
+	if (len < (ssize_t)LARGE_HEADER_SIZE || packet[0] != START_MARKER) {
+		return nullptr;
+	}
 
-	while (true) {
-		ssize_t bytes_received = recv(sockfd, (void *) &frame, sizeof(Frame), 0);
-			
-		if (bytes_received < 0 || frame.start_marker != START_MARKER) {
-			continue;
+	uint8_t tags = packet[WIRE_TYPE_OFFSET];
+	if ((tags & LARGE_FRAME_TAG) == LARGE_FRAME_TAG) {
+		uint16_t length = get_le16(packet + WIRE_LENGTH_OFFSET);
+		size_t trailer = (tags & CRC32C_FRAME_TAG) ? CRC32C_SIZE : 0;
+		if (LARGE_HEADER_SIZE + length + trailer > (size_t)len) {
+			return nullptr;
 		}
 
-		int rand = TEST_ERRORS == 1 ? dist(gen) : -1;
-
-		if (frame.crc != calculate_crc(frame) || frame.sequence != seq || rand == 1) {
-			send_nack(sockfd, seq);
+		bool intact;
+		if (trailer > 0) {
+			// the CRC-32C covers the header as sent, tags included
+			uint32_t crc;
+			memcpy(&crc, packet + LARGE_HEADER_SIZE + length, sizeof(crc));
+			intact = ntohl(crc) == crc32c(0, packet, LARGE_HEADER_SIZE + length);
+			packet[WIRE_TYPE_OFFSET] &= ~(LARGE_FRAME_TAG | CRC32C_FRAME_TAG);
 		} else {
-			send_ack(sockfd, seq);
-			break;
+			packet[WIRE_TYPE_OFFSET] &= ~LARGE_FRAME_TAG;
+			uint8_t crc = crc8(0, packet, WIRE_CRC_OFFSET);
+			intact = packet[WIRE_CRC_OFFSET] == crc8(crc, packet + LARGE_HEADER_SIZE, length);
 		}
+
+		// Frame overlays the wire header, decode in place in the receive buffer
+		Frame *frame = reinterpret_cast<Frame *>(packet);
+		frame->session = get_le16(packet + WIRE_SESSION_OFFSET);
+		frame->sequence = get_le16(packet + WIRE_SEQUENCE_OFFSET);
+		frame->length = length;
+		frame->crc = intact ? CRC_INTACT : CRC_CORRUPT;
+		return frame;
 	}
-}
 
+	if (len < (ssize_t)LEGACY_FRAME_SIZE) {
+		return nullptr;
+	}
+	// a legacy payload is FRAME_DATA_SIZE at most
+	static thread_local ControlFrame decoded;
+	Frame &frame = control_frame(decoded);
+	frame.start_marker = packet[0];
+	frame.type = packet[LEGACY_TYPE_OFFSET] & LEGACY_TYPE_MASK;
+	frame.session = 0;
+	frame.sequence = get_le16(packet + LEGACY_SEQUENCE_OFFSET);
+	frame.length = packet[LEGACY_LENGTH_OFFSET] & LEGACY_LENGTH_MASK;
+	memcpy(frame.data, packet + LEGACY_DATA_OFFSET, frame.length);
+
+	bool intact = packet[LEGACY_CRC_OFFSET] == calculate_legacy_crc(packet);
+	frame.crc = intact ? CRC_INTACT : CRC_CORRUPT;
+	return &frame;
+}
 
-void send_ack(int sockfd, uint8_t sequence) {
-	Frame ack;
-	ack.start_marker = START_MARKER;
-	ack.length = 0;
-	ack.sequence = sequence;
-	ack.type = TYPE_ACK;
-	ack.crc = calculate_crc(ack);
+bool receive_frame(int sockfd, Frame &frame, int64_t timeout_us) {
+	const Frame *view = receive_frame_view(sockfd, timeout_us);
+	if (view == nullptr) {
+		return false;
+	}
 
-	send(sockfd, reinterpret_cast<void *>(&ack), sizeof(ack), 0);
+	copy_frame(frame, *view);
+	return true;
 }
 
-void send_nack(int sockfd, uint8_t sequence) {
-	Frame nack;
-	nack.start_marker = START_MARKER;
-	nack.length = 0;
-	nack.sequence = sequence;
-	nack.type = TYPE_NACK;
-	nack.crc = calculate_crc(nack);
+void copy_frame(Frame &destination, const Frame &source) {
+	memcpy(&destination, &source, LARGE_HEADER_SIZE + source.length);
+}
 
-	send(sockfd, (void *)&nack, sizeof(nack), 0);
-	if (SHOW_LOGS == 1) cout << "Sent NACK to frame " << (int)sequence << endl;
-}
\ No newline at end of file
+Frame &control_frame(ControlFrame &control) {
+	return *reinterpret_cast<Frame *>(control.bytes);
+}
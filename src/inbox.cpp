@@ -0,0 +1,69 @@
+#include "../inc/inbox.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+void inbox_init(Inbox &inbox) {
+	inbox.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (inbox.event_fd < 0) {
+		perror("Failed to create inbox event");
+		exit(EXIT_FAILURE);
+	}
+	inbox.closed = false;
+}
+
+static void signal_inbox(Inbox &inbox) {
+	uint64_t one = 1;
+	if (write(inbox.event_fd, &one, sizeof(one)) < 0) {
+		// the counter is already set, the consumer will wake anyway
+	}
+}
+
+void inbox_push(Inbox &inbox, const Frame &frame) {
+	lock_guard<mutex> guard(inbox.lock);
+	if (inbox.closed || inbox.frames.size() >= INBOX_SIZE) {
+		return;
+	}
+
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&frame);
+	inbox.frames.emplace_back(bytes, bytes + LARGE_HEADER_SIZE + frame.length);
+	if (inbox.frames.size() == 1) {
+		signal_inbox(inbox);
+	}
+}
+
+const Frame *inbox_pop(Inbox &inbox) {
+	lock_guard<mutex> guard(inbox.lock);
+	if (inbox.frames.empty()) {
+		// reset under the lock, a push after this signals again
+		uint64_t count;
+		if (read(inbox.event_fd, &count, sizeof(count)) < 0) {
+			// nothing was signaled
+		}
+		return nullptr;
+	}
+
+	vector<uint8_t> &bytes = inbox.frames.front();
+	memcpy(&inbox.popped, bytes.data(), bytes.size());
+	inbox.frames.pop_front();
+	return &inbox.popped;
+}
+
+void inbox_shutdown(Inbox &inbox) {
+	lock_guard<mutex> guard(inbox.lock);
+	if (!inbox.closed) {
+		inbox.closed = true;
+		signal_inbox(inbox);
+	}
+}
+
+void inbox_close(Inbox &inbox) {
+	lock_guard<mutex> guard(inbox.lock);
+	inbox.closed = true;
+	inbox.frames.clear();
+	close(inbox.event_fd);
+}
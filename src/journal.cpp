@@ -0,0 +1,95 @@
+#include "../inc/journal.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+void journal_init(Journal &journal, const string &filename, uint64_t size, int64_t mtime) {
+	journal.path = filename + JOURNAL_SUFFIX;
+	journal.size = size;
+	journal.mtime = mtime;
+	journal.done.clear();
+}
+
+// First line is the size and mtime of the remote file, one "offset length" line per range after
+bool journal_load(Journal &journal) {
+	ifstream in(journal.path);
+	uint64_t size;
+	int64_t mtime;
+	if (!(in >> size >> mtime) || size != journal.size || mtime != journal.mtime) {
+		return false;
+	}
+
+	ByteRange range;
+	while (in >> range.offset >> range.length) {
+		journal_add(journal, range.offset, range.length);
+	}
+	return !journal.done.empty();
+}
+
+void journal_add(Journal &journal, uint64_t offset, uint64_t length) {
+	uint64_t end = min(offset + length, journal.size);
+	if (offset >= end) {
+		return;
+	}
+
+	// merged with every range it overlaps or touches
+	vector<ByteRange> merged;
+	for (const ByteRange &range : journal.done) {
+		if (range.offset + range.length < offset || range.offset > end) {
+			merged.push_back(range);
+		} else {
+			end = max(end, range.offset + range.length);
+			offset = min(offset, range.offset);
+		}
+	}
+	merged.push_back({offset, end - offset});
+	sort(merged.begin(), merged.end(),
+		 [](const ByteRange &a, const ByteRange &b) { return a.offset < b.offset; });
+	journal.done = merged;
+}
+
+vector<ByteRange> journal_missing(const Journal &journal) {
+	vector<ByteRange> missing;
+	uint64_t offset = 0;
+	for (const ByteRange &range : journal.done) {
+		if (range.offset > offset) {
+			missing.push_back({offset, range.offset - offset});
+		}
+		offset = range.offset + range.length;
+	}
+	if (offset < journal.size) {
+		missing.push_back({offset, journal.size - offset});
+	}
+	return missing;
+}
+
+uint64_t journal_done_bytes(const Journal &journal) {
+	uint64_t done = 0;
+	for (const ByteRange &range : journal.done) {
+		done += range.length;
+	}
+	return done;
+}
+
+bool journal_save(const Journal &journal) {
+	// written aside and renamed over, a crash never leaves half a journal
+	string temporary = journal.path + ".tmp";
+	{
+		ofstream out(temporary, ios::trunc);
+		out << journal.size << " " << journal.mtime << "\n";
+		for (const ByteRange &range : journal.done) {
+			out << range.offset << " " << range.length << "\n";
+		}
+		out.flush();
+		if (!out) {
+			remove(temporary.c_str());
+			return false;
+		}
+	}
+	return rename(temporary.c_str(), journal.path.c_str()) == 0;
+}
+
+void journal_remove(const Journal &journal) {
+	remove(journal.path.c_str());
+}
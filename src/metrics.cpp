@@ -0,0 +1,215 @@
+#include "../inc/metrics.h"
+
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+
+#include "../inc/trace.h"
+
+// sessions still running are added up from their own metrics, ended ones are kept as totals
+static mutex registry_lock;
+static unordered_set<Metrics *> running;
+static MetricsSnapshot ended = {};
+
+CacheMetrics cache_metrics = {};
+
+void histogram_add(Histogram &histogram, uint64_t value) {
+	int bucket = value == 0 ? 0 : min(64 - __builtin_clzll(value), METRIC_BUCKETS - 1);
+	histogram.buckets[bucket].fetch_add(1, memory_order_relaxed);
+}
+
+uint64_t histogram_percentile(const uint64_t buckets[METRIC_BUCKETS], double fraction) {
+	uint64_t total = 0;
+	for (int i = 0; i < METRIC_BUCKETS; i++) {
+		total += buckets[i];
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < METRIC_BUCKETS && total > 0; i++) {
+		seen += buckets[i];
+		if (seen > fraction * total) {
+			return i == 0 ? 0 : 1ULL << i;
+		}
+	}
+	return 0;
+}
+
+Metrics *metrics_open() {
+	// value initialized, every counter starts at 0
+	Metrics *metrics = new Metrics();
+	lock_guard<mutex> guard(registry_lock);
+	running.insert(metrics);
+	return metrics;
+}
+
+static void add_metrics(MetricsSnapshot &snapshot, const Metrics &metrics) {
+	snapshot.frames_sent += metrics.frames_sent.load(memory_order_relaxed);
+	snapshot.frames_received += metrics.frames_received.load(memory_order_relaxed);
+	snapshot.retransmits += metrics.retransmits.load(memory_order_relaxed);
+	snapshot.nacks += metrics.nacks.load(memory_order_relaxed);
+	snapshot.timeouts += metrics.timeouts.load(memory_order_relaxed);
+	snapshot.crc_failures += metrics.crc_failures.load(memory_order_relaxed);
+	snapshot.duplicates += metrics.duplicates.load(memory_order_relaxed);
+	snapshot.rebuilt += metrics.rebuilt.load(memory_order_relaxed);
+	for (int i = 0; i < METRIC_BUCKETS; i++) {
+		snapshot.rtt_us[i] += metrics.rtt_us.buckets[i].load(memory_order_relaxed);
+		snapshot.window_frames[i] += metrics.window_frames.buckets[i].load(memory_order_relaxed);
+	}
+}
+
+void metrics_close(Metrics *metrics) {
+	{
+		lock_guard<mutex> guard(registry_lock);
+		running.erase(metrics);
+		add_metrics(ended, *metrics);
+		ended.sessions_ended++;
+	}
+	delete metrics;
+}
+
+MetricsSnapshot metrics_snapshot() {
+	lock_guard<mutex> guard(registry_lock);
+	MetricsSnapshot snapshot = ended;
+	for (const Metrics *metrics : running) {
+		add_metrics(snapshot, *metrics);
+	}
+	snapshot.sessions = running.size();
+	snapshot.cache_capacity = cache_metrics.capacity.load(memory_order_relaxed);
+	snapshot.cache_bytes = cache_metrics.bytes.load(memory_order_relaxed);
+	snapshot.cache_files = cache_metrics.files.load(memory_order_relaxed);
+	snapshot.cache_hits = cache_metrics.hits.load(memory_order_relaxed);
+	snapshot.cache_misses = cache_metrics.misses.load(memory_order_relaxed);
+	snapshot.cache_evictions = cache_metrics.evictions.load(memory_order_relaxed);
+	return snapshot;
+}
+
+string metrics_format(const MetricsSnapshot &snapshot) {
+	ostringstream line;
+	line << "sessions=" << snapshot.sessions << " sessions_ended=" << snapshot.sessions_ended
+		 << " frames_sent=" << snapshot.frames_sent
+		 << " frames_received=" << snapshot.frames_received
+		 << " retransmits=" << snapshot.retransmits << " nacks=" << snapshot.nacks
+		 << " timeouts=" << snapshot.timeouts << " crc_failures=" << snapshot.crc_failures
+		 << " duplicates=" << snapshot.duplicates << " rebuilt=" << snapshot.rebuilt
+		 << " rtt_p50_us=" << histogram_percentile(snapshot.rtt_us, 0.5)
+		 << " rtt_p99_us=" << histogram_percentile(snapshot.rtt_us, 0.99)
+		 << " window_p50=" << histogram_percentile(snapshot.window_frames, 0.5)
+		 << " window_p99=" << histogram_percentile(snapshot.window_frames, 0.99);
+	if (snapshot.cache_capacity > 0) {
+		uint64_t lookups = snapshot.cache_hits + snapshot.cache_misses;
+		line << " cache_hits=" << snapshot.cache_hits << " cache_misses=" << snapshot.cache_misses
+			 << " cache_hit_rate=" << fixed << setprecision(3)
+			 << (lookups > 0 ? (double)snapshot.cache_hits / lookups : 0.0)
+			 << " cache_files=" << snapshot.cache_files << " cache_bytes=" << snapshot.cache_bytes
+			 << " cache_capacity=" << snapshot.cache_capacity
+			 << " cache_evictions=" << snapshot.cache_evictions;
+	}
+	return line.str();
+}
+
+// Listening socket for stats queries, -1 when it can't be made, queries are optional
+static int open_socket(const string &path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	struct sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (fd < 0 || path.size() >= sizeof(address.sun_path)) {
+		perror("Failed to create stats socket");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	strcpy(address.sun_path, path.c_str());
+	// left behind by a server that didn't stop cleanly
+	unlink(path.c_str());
+	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+		perror("Failed to listen for stats queries");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void metrics_serve(MetricsServer &server, const string &socket_path) {
+	// SIGUSR1 is read from a signalfd by the metrics thread, no thread may take it before
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	server.stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (signal_fd < 0 || server.stop_fd < 0) {
+		perror("Failed to start metrics thread");
+		exit(EXIT_FAILURE);
+	}
+	server.socket_path = socket_path;
+	int listen_fd = open_socket(socket_path);
+
+	server.worker = thread([&server, signal_fd, listen_fd]() {
+		Reactor reactor;
+		reactor_init(reactor);
+		reactor_watch(reactor, server.stop_fd, [&]() { reactor_stop(reactor); });
+
+		reactor_watch(reactor, signal_fd, [&]() {
+			struct signalfd_siginfo info;
+			if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+				if (trace_dump(TRACE_DUMP_FILE)) {
+					cout << "Trace dumped to " << TRACE_DUMP_FILE << endl;
+				} else {
+					perror("Failed to dump trace");
+				}
+			}
+		});
+
+		if (listen_fd >= 0) {
+			reactor_watch(reactor, listen_fd, [&]() {
+				int client;
+				while ((client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+					string line = metrics_format(metrics_snapshot()) + "\n";
+					if (send(client, line.data(), line.size(), MSG_NOSIGNAL) < 0) {
+						perror("Failed to answer stats query");
+					}
+					close(client);
+				}
+			});
+		}
+
+		int interval = -1;
+		if (METRICS_INTERVAL_SECONDS > 0) {
+			interval = reactor_create_timer(reactor);
+			reactor_watch(reactor, interval, [&]() {
+				cout << metrics_format(metrics_snapshot()) << endl;
+				reactor_arm_timer(interval, METRICS_INTERVAL_SECONDS * 1000000LL);
+			});
+			reactor_arm_timer(interval, METRICS_INTERVAL_SECONDS * 1000000LL);
+		}
+
+		reactor_run(reactor);
+		reactor_close(reactor);
+		close(signal_fd);
+		if (listen_fd >= 0) {
+			close(listen_fd);
+		}
+	});
+}
+
+void metrics_stop(MetricsServer &server) {
+	uint64_t one = 1;
+	if (write(server.stop_fd, &one, sizeof(one)) < 0) {
+		perror("Failed to stop metrics thread");
+	}
+	server.worker.join();
+	close(server.stop_fd);
+	unlink(server.socket_path.c_str());
+}
@@ -0,0 +1,242 @@
+#include "../inc/options.h"
+
+#include "../inc/fec.h"
+
+#include <endian.h>
+
+using namespace std;
+
+TransferOptions legacy_options() {
+	TransferOptions options;
+	options.format = FORMAT_LEGACY;
+	options.payload_size = FRAME_DATA_SIZE;
+	options.session_id = 0;
+	options.selective_ack = false;
+	options.fec = false;
+	options.packed_list = false;
+	options.ranges = false;
+	options.compression = false;
+	options.compressed = false;
+	return options;
+}
+
+TransferOptions local_options(int mtu) {
+	TransferOptions options;
+	options.format = USE_CRC32C == 1 ? FORMAT_LARGE_CRC32C : FORMAT_LARGE;
+	// the CRC-32C and the header of parity frames have to fit in the MTU as well
+	options.payload_size = max_payload_for_mtu(mtu - (USE_CRC32C == 1 ? CRC32C_SIZE : 0) -
+											   (USE_FEC == 1 ? FEC_HEADER_SIZE : 0));
+	options.session_id = 0;
+	options.selective_ack = USE_SACK == 1;
+	options.fec = USE_SACK == 1 && USE_FEC == 1;
+	options.packed_list = USE_PACKED_LIST == 1;
+	options.ranges = USE_RANGES == 1;
+	options.compression = USE_COMPRESSION == 1;
+	options.compressed = false;
+	return options;
+}
+
+TransferOptions negotiate_options(const TransferOptions &local, const TransferOptions &remote) {
+	if (local.format == FORMAT_LEGACY || remote.format == FORMAT_LEGACY) {
+		return legacy_options();
+	}
+
+	TransferOptions options;
+	options.format = local.format == FORMAT_LARGE_CRC32C && remote.format == FORMAT_LARGE_CRC32C
+						 ? FORMAT_LARGE_CRC32C
+						 : FORMAT_LARGE;
+	options.payload_size = min(local.payload_size, remote.payload_size);
+	options.session_id = remote.session_id;
+	options.selective_ack = local.selective_ack && remote.selective_ack;
+	options.fec = options.selective_ack && local.fec && remote.fec;
+	options.packed_list = local.packed_list && remote.packed_list;
+	options.ranges = local.ranges && remote.ranges;
+	options.compression = local.compression && remote.compression;
+	// the server only knows once it looked at what is asked for
+	options.compressed = false;
+	return options;
+}
+
+uint16_t new_session_id() {
+	static thread_local mt19937 gen(random_device{}());
+	uniform_int_distribution<> dist(1, UINT16_MAX);
+	return dist(gen);
+}
+
+static void write_option(Frame &frame, uint8_t type, uint16_t value) {
+	uint8_t *option = frame.data + frame.length;
+	value = htons(value);
+	option[0] = type;
+	option[1] = sizeof(value);
+	memcpy(option + 2, &value, sizeof(value));
+	frame.length += 2 + sizeof(value);
+}
+
+void write_options(Frame &frame, const TransferOptions &options) {
+	if (options.format == FORMAT_LEGACY) {
+		return;
+	}
+
+	write_option(frame, OPTION_MAX_PAYLOAD, options.payload_size);
+	if (options.session_id != 0) {
+		write_option(frame, OPTION_SESSION_ID, options.session_id);
+	}
+	if (options.format == FORMAT_LARGE_CRC32C) {
+		write_option(frame, OPTION_CHECKSUM, CHECKSUM_CRC32C);
+	}
+	if (options.selective_ack) {
+		write_option(frame, OPTION_SELECTIVE_ACK, 1);
+	}
+	if (options.fec) {
+		write_option(frame, OPTION_FEC, 1);
+	}
+	if (options.packed_list) {
+		write_option(frame, OPTION_PACKED_LIST, 1);
+	}
+	if (options.ranges) {
+		write_option(frame, OPTION_RANGES, 1);
+	}
+	if (options.compression) {
+		write_option(frame, OPTION_COMPRESSION, COMPRESSION_LZ);
+	}
+	if (options.compressed) {
+		write_option(frame, OPTION_COMPRESSED, 1);
+	}
+}
+
+TransferOptions read_options(const Frame &frame, uint16_t offset) {
+	TransferOptions options = legacy_options();
+	bool wants_crc32c = false;
+
+	// unknown options are skipped so newer peers can add their own
+	while (offset + 2 <= frame.length) {
+		uint8_t type = frame.data[offset];
+		uint8_t length = frame.data[offset + 1];
+		const uint8_t *value = frame.data + offset + 2;
+		if (offset + 2 + length > frame.length) {
+			break;
+		}
+
+		if (type == OPTION_MAX_PAYLOAD && length == sizeof(uint16_t)) {
+			uint16_t payload_size;
+			memcpy(&payload_size, value, sizeof(payload_size));
+			options.format = FORMAT_LARGE;
+			// a payload smaller than a legacy one leaves no room for descriptors and SACKs
+			options.payload_size =
+				clamp<uint16_t>(ntohs(payload_size), FRAME_DATA_SIZE, MAX_FRAME_DATA_SIZE);
+		} else if (type == OPTION_SESSION_ID && length == sizeof(uint16_t)) {
+			uint16_t session_id;
+			memcpy(&session_id, value, sizeof(session_id));
+			options.session_id = ntohs(session_id);
+		} else if (type == OPTION_CHECKSUM && length == sizeof(uint16_t)) {
+			uint16_t checksum;
+			memcpy(&checksum, value, sizeof(checksum));
+			wants_crc32c = ntohs(checksum) == CHECKSUM_CRC32C;
+		} else if (type == OPTION_SELECTIVE_ACK && length == sizeof(uint16_t)) {
+			uint16_t selective_ack;
+			memcpy(&selective_ack, value, sizeof(selective_ack));
+			options.selective_ack = ntohs(selective_ack) == 1;
+		} else if (type == OPTION_FEC && length == sizeof(uint16_t)) {
+			uint16_t fec;
+			memcpy(&fec, value, sizeof(fec));
+			options.fec = ntohs(fec) == 1;
+		} else if (type == OPTION_PACKED_LIST && length == sizeof(uint16_t)) {
+			uint16_t packed_list;
+			memcpy(&packed_list, value, sizeof(packed_list));
+			options.packed_list = ntohs(packed_list) == 1;
+		} else if (type == OPTION_RANGES && length == sizeof(uint16_t)) {
+			uint16_t ranges;
+			memcpy(&ranges, value, sizeof(ranges));
+			options.ranges = ntohs(ranges) == 1;
+		} else if (type == OPTION_COMPRESSION && length == sizeof(uint16_t)) {
+			uint16_t compression;
+			memcpy(&compression, value, sizeof(compression));
+			options.compression = ntohs(compression) == COMPRESSION_LZ;
+		} else if (type == OPTION_COMPRESSED && length == sizeof(uint16_t)) {
+			uint16_t compressed;
+			memcpy(&compressed, value, sizeof(compressed));
+			options.compressed = ntohs(compressed) == 1;
+		}
+		offset += 2 + length;
+	}
+
+	// a checksum alone doesn't make a large peer, only the payload option does
+	if (wants_crc32c && options.format == FORMAT_LARGE) {
+		options.format = FORMAT_LARGE_CRC32C;
+	}
+	options.selective_ack = options.selective_ack && options.format != FORMAT_LEGACY;
+	options.fec = options.fec && options.selective_ack;
+	options.packed_list = options.packed_list && options.format != FORMAT_LEGACY;
+	options.ranges = options.ranges && options.format != FORMAT_LEGACY;
+	options.compression = options.compression && options.format != FORMAT_LEGACY;
+	options.compressed = options.compressed && options.compression;
+
+	return options;
+}
+
+string request_filename(const Frame &request) {
+	size_t length = strnlen((const char *)request.data, request.length);
+	return string((const char *)request.data, length);
+}
+
+TransferOptions request_options(const Frame &request) {
+	if (request.type == TYPE_LIST) {
+		return read_options(request, 0);
+	}
+
+	// legacy DOWNLOAD requests are just the filename with no terminator
+	size_t name_length = strnlen((const char *)request.data, request.length);
+	if (name_length == request.length) {
+		return legacy_options();
+	}
+	return read_options(request, name_length + 1);
+}
+
+void write_range(Frame &request, const ByteRange &range) {
+	uint8_t *option = request.data + request.length;
+	uint64_t offset = htobe64(range.offset);
+	uint64_t length = htobe64(range.length);
+	option[0] = OPTION_RANGE;
+	option[1] = sizeof(offset) + sizeof(length);
+	memcpy(option + 2, &offset, sizeof(offset));
+	memcpy(option + 2 + sizeof(offset), &length, sizeof(length));
+	request.length += 2 + option[1];
+}
+
+ByteRange request_range(const Frame &request) {
+	ByteRange range = {0, 0};
+	size_t offset = strnlen((const char *)request.data, request.length) + 1;
+	while (offset + 2 <= request.length) {
+		uint8_t type = request.data[offset];
+		uint8_t length = request.data[offset + 1];
+		if (offset + 2 + length > request.length) {
+			break;
+		}
+		if (type == OPTION_RANGE && length == 2 * sizeof(uint64_t)) {
+			memcpy(&range.offset, request.data + offset + 2, sizeof(range.offset));
+			memcpy(&range.length, request.data + offset + 2 + sizeof(range.offset),
+				   sizeof(range.length));
+			range.offset = be64toh(range.offset);
+			range.length = be64toh(range.length);
+		}
+		offset += 2 + length;
+	}
+	return range;
+}
+
+void write_file_size(Frame &descriptor, uint64_t size) {
+	size = htobe64(size);
+	descriptor.data[descriptor.length++] = '\0';
+	memcpy(descriptor.data + descriptor.length, &size, sizeof(size));
+	descriptor.length += sizeof(size);
+}
+
+uint64_t read_file_size(const Frame &descriptor) {
+	size_t name_length = strnlen((const char *)descriptor.data, descriptor.length);
+	uint64_t size;
+	if (name_length + 1 + sizeof(size) > descriptor.length) {
+		return 0;
+	}
+	memcpy(&size, descriptor.data + name_length + 1, sizeof(size));
+	return be64toh(size);
+}
@@ -0,0 +1,209 @@
+#include "../inc/prefetcher.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "../inc/compress.h"
+
+static void signal_event(int fd) {
+	uint64_t one = 1;
+	if (write(fd, &one, sizeof(one)) < 0) {
+		// the counter is already set
+	}
+}
+
+// Waits for room in the ring, false when stopped meanwhile
+static bool hand_over(Prefetcher &prefetcher, const PreparedFrame &frame) {
+	while (!spsc_push(prefetcher.ring, frame)) {
+		// say we wait before the last look, a pop after it is then sure to signal
+		prefetcher.producer_waiting = true;
+		if (spsc_push(prefetcher.ring, frame)) {
+			break;
+		}
+		uint64_t count;
+		if (prefetcher.stopping || read(prefetcher.space_fd, &count, sizeof(count)) < 0) {
+			return false;
+		}
+	}
+	if (spsc_size(prefetcher.ring) == 1) {
+		signal_event(prefetcher.ready_fd);
+	}
+	return true;
+}
+
+static PreparedFrame make_frame(Prefetcher &prefetcher, uint16_t sequence, const uint8_t *payload,
+								uint16_t length, const PayloadCrc *checksums) {
+	PreparedFrame frame;
+	frame.header.start_marker = START_MARKER;
+	frame.header.type = length > 0 ? TYPE_DATA : TYPE_END_TX;
+	frame.header.session = prefetcher.options.session_id;
+	frame.header.sequence = sequence;
+	frame.header.length = length;
+	frame.header.crc = checksums != nullptr ? calculate_crc(frame.header, *checksums)
+											: calculate_crc(frame.header, payload);
+	frame.payload = payload;
+	frame.checksums = checksums;
+	return frame;
+}
+
+// A payload has its checksums in the cache when it is a whole frame of the cached file, a range
+// starting between frames has to have them computed
+static PreparedFrame next_cached_frame(Prefetcher &prefetcher) {
+	const FileSource &file = *prefetcher.file;
+	const CachedFile &cached = *prefetcher.cached;
+	uint16_t length = min<size_t>(prefetcher.options.payload_size, file.size - prefetcher.offset);
+	const uint8_t *payload = file.data + prefetcher.offset;
+	const PayloadCrc *checksums = nullptr;
+	if (length > 0) {
+		size_t at = payload - cached.bytes.data();
+		if (at % cached.payload_size == 0 &&
+			(length == cached.payload_size || at + length == cached.bytes.size())) {
+			checksums = &cached.frames[at / cached.payload_size];
+		}
+	}
+	PreparedFrame prepared =
+		make_frame(prefetcher, prefetcher.sequence, payload, length, checksums);
+	prefetcher.offset += length;
+	prefetcher.sequence = (prefetcher.sequence + 1) % MAX_SEQ;
+	return prepared;
+}
+
+static void run_producer(Prefetcher &prefetcher) {
+	FileSource &file = *prefetcher.file;
+	size_t offset = 0;
+	uint16_t sequence = 0;
+
+	while (!prefetcher.stopping) {
+		// reading the payload for the crc is what faults the pages in, off the transmit thread
+		uint16_t length = min<size_t>(prefetcher.options.payload_size, file.size - offset);
+		PreparedFrame frame = make_frame(prefetcher, sequence, file.data + offset, length, nullptr);
+		offset += length;
+		file_source_prefetch(file, offset);
+
+		// end of transmition frame is the last one
+		if (!hand_over(prefetcher, frame) || length == 0) {
+			return;
+		}
+		sequence = (sequence + 1) % MAX_SEQ;
+	}
+}
+
+// The file goes compressed block by block into chunks, and frames are cut from them. What is
+// left of a chunk after its last full frame starts the next one, so a payload never spans two
+static void run_compressing_producer(Prefetcher &prefetcher) {
+	FileSource &file = *prefetcher.file;
+	const size_t payload_size = prefetcher.options.payload_size;
+	vector<uint8_t> block(COMPRESS_BLOCK_HEADER + COMPRESS_BLOCK_BYTES);
+	CompressedChunk *chunk = nullptr;
+	size_t framed = 0;	// bytes of the chunk already in frames
+	size_t offset = 0;
+	uint64_t index = 0;
+	uint16_t sequence = 0;
+
+	while (!prefetcher.stopping) {
+		size_t left = chunk != nullptr ? chunk->bytes.size() - framed : 0;
+		if (left < payload_size && offset < file.size) {
+			// chunks whose frames are all done with make room first, the last one is still cut
+			while (prefetcher.chunks.size() > 1 &&
+				   prefetcher.chunks.front().last_frame < prefetcher.released) {
+				prefetcher.chunks.pop_front();
+			}
+
+			size_t raw = min<size_t>(COMPRESS_BLOCK_BYTES, file.size - offset);
+			size_t stored = compress_block(file.data + offset, raw, block.data());
+			offset += raw;
+			file_source_prefetch(file, offset);
+
+			CompressedChunk next;
+			next.bytes.reserve(left + stored);
+			if (left > 0) {
+				next.bytes.assign(chunk->bytes.begin() + framed, chunk->bytes.end());
+			}
+			next.bytes.insert(next.bytes.end(), block.begin(), block.begin() + stored);
+			next.last_frame = index;
+			prefetcher.chunks.push_back(move(next));
+			chunk = &prefetcher.chunks.back();
+			framed = 0;
+			continue;
+		}
+
+		uint16_t length = min(left, payload_size);
+		const uint8_t *payload = chunk != nullptr ? chunk->bytes.data() + framed : nullptr;
+		PreparedFrame frame = make_frame(prefetcher, sequence, payload, length, nullptr);
+		framed += length;
+		if (chunk != nullptr) {
+			chunk->last_frame = index;
+		}
+
+		if (!hand_over(prefetcher, frame) || length == 0) {
+			return;
+		}
+		index++;
+		sequence = (sequence + 1) % MAX_SEQ;
+	}
+}
+
+// Ring and events of either kind of prefetcher
+static void prefetcher_init(Prefetcher &prefetcher, FileSource &file,
+							const TransferOptions &options) {
+	prefetcher.file = &file;
+	prefetcher.options = options;
+	spsc_init(prefetcher.ring, PREFETCH_FRAMES);
+	prefetcher.ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	prefetcher.space_fd = eventfd(0, EFD_CLOEXEC);
+	if (prefetcher.ready_fd < 0 || prefetcher.space_fd < 0) {
+		perror("Failed to create prefetch events");
+		exit(EXIT_FAILURE);
+	}
+	prefetcher.producer_waiting = false;
+	prefetcher.stopping = false;
+	prefetcher.chunks.clear();
+	prefetcher.released = 0;
+	prefetcher.cached = nullptr;
+	prefetcher.offset = 0;
+	prefetcher.sequence = 0;
+}
+
+void prefetcher_start(Prefetcher &prefetcher, FileSource &file, const TransferOptions &options) {
+	prefetcher_init(prefetcher, file, options);
+	prefetcher.producer = thread(options.compressed ? run_compressing_producer : run_producer,
+								 ref(prefetcher));
+}
+
+void prefetcher_start_cached(Prefetcher &prefetcher, FileSource &file, const CachedFile &cached,
+							 const TransferOptions &options) {
+	prefetcher_init(prefetcher, file, options);
+	prefetcher.cached = &cached;
+}
+
+bool prefetcher_next(Prefetcher &prefetcher, PreparedFrame &frame) {
+	if (prefetcher.cached != nullptr) {
+		frame = next_cached_frame(prefetcher);
+		return true;
+	}
+	if (!spsc_pop(prefetcher.ring, frame)) {
+		return false;
+	}
+	if (prefetcher.producer_waiting && prefetcher.producer_waiting.exchange(false)) {
+		signal_event(prefetcher.space_fd);
+	}
+	return true;
+}
+
+void prefetcher_release(Prefetcher &prefetcher, uint64_t frames) {
+	// their last sends happen before the producer sees them released
+	prefetcher.released.store(frames, memory_order_release);
+}
+
+void prefetcher_stop(Prefetcher &prefetcher) {
+	prefetcher.stopping = true;
+	signal_event(prefetcher.space_fd);
+	if (prefetcher.producer.joinable()) {
+		prefetcher.producer.join();
+	}
+	close(prefetcher.ready_fd);
+	close(prefetcher.space_fd);
+}
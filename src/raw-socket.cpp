@@ -1,25 +1,78 @@
 
 #include <arpa/inet.h>
 #include <dirent.h>
+#include <linux/filter.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <cerrno>
 #include <cstdint>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
 #include "../inc/raw-socket.h"
+#include "../inc/frame.h"
 
-// Creates a raw socket
+// State kept for every socket created here
+struct SocketState {
+	int64_t timeout_us;
+	// where frames go, broadcast until a peer is known
+	struct sockaddr_ll peer;
+	// source of the last packet received
+	uint8_t last_source[ETH_ALEN];
+	// recv() fallback
+	vector<uint8_t> buffer;
+	// TPACKET_V3 ring, blocks are handed back to the kernel once every packet in them was read
+	uint8_t *ring;
+	size_t ring_size;
+	unsigned int block;	 // block being read
+	struct tpacket3_hdr *packet;
+	uint32_t packets_left;
+	bool holding_block;
+};
+
+// sockets are created and closed from several threads, each one is only used by one at a time.
+// References to the states stay valid while other sockets come and go
+static unordered_map<int, SocketState> socket_states;
+static mutex socket_states_lock;
+
+static int create_sender_like(int sockfd, const uint8_t *peer);
+
+static const TransportOps raw_socket_transport = {
+	raw_socket_receive,		raw_socket_send_batch,	 create_sender_like,
+	raw_socket_set_peer,	raw_socket_last_source, raw_socket_peer,
+	raw_socket_close,
+};
+
+static SocketState &socket_state(int sockfd) {
+	lock_guard<mutex> guard(socket_states_lock);
+	SocketState &state = socket_states[sockfd];
+	if (state.buffer.empty()) {
+		state.buffer.resize(RX_BUFFER_SIZE);
+		state.peer.sll_family = AF_PACKET;
+		state.peer.sll_protocol = htons(PROTOCOL_ETHERTYPE);
+		state.peer.sll_halen = ETH_ALEN;
+		memset(state.peer.sll_addr, 0xFF, ETH_ALEN);
+	}
+	return state;
+}
+
+// Creates a raw socket. It is a datagram packet socket: the kernel builds and strips the
+// ethernet header, and nothing is received until it is bound to our EtherType
 int create_socket() {
-	int sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	int sockfd = socket(AF_PACKET, SOCK_DGRAM, 0);
 	if (sockfd == -1) {
 		perror("socket");
 		exit(EXIT_FAILURE);
@@ -37,12 +90,27 @@ int get_interface_index(const char *interface_name) {
 	return interface_index;
 }
 
+// Gets the MTU of the specified network interface
+int get_interface_mtu(const char *interface_name) {
+	int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct ifreq request;
+	memset(&request, 0, sizeof(request));
+	strncpy(request.ifr_name, interface_name, IFNAMSIZ - 1);
+
+	if (sockfd == -1 || ioctl(sockfd, SIOCGIFMTU, &request) == -1) {
+		perror("Error obtaining interface MTU");
+		exit(EXIT_FAILURE);
+	}
+	close(sockfd);
+	return request.ifr_mtu;
+}
+
 // Binds the socket to the specified network interface
 void bind_socket_to_interface(int sockfd, int interface_index) {
 	struct sockaddr_ll address;
 	memset(&address, 0, sizeof(address));
 	address.sll_family = AF_PACKET;
-	address.sll_protocol = htons(ETH_P_ALL);
+	address.sll_protocol = htons(PROTOCOL_ETHERTYPE);
 	address.sll_ifindex = interface_index;
 
 	if (bind(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
@@ -50,6 +118,30 @@ void bind_socket_to_interface(int sockfd, int interface_index) {
 		close(sockfd);
 		exit(EXIT_FAILURE);
 	}
+	socket_state(sockfd).peer.sll_ifindex = interface_index;
+}
+
+// Lets only our EtherType with the frame start marker reach user space
+void attach_protocol_filter(int sockfd) {
+	struct sock_filter code[] = {
+		// A = EtherType of the packet
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_PROTOCOL)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PROTOCOL_ETHERTYPE, 0, 3),
+		// A = first byte after the ethernet header
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, START_MARKER, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog program;
+	program.len = sizeof(code) / sizeof(code[0]);
+	program.filter = code;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1) {
+		perror("setsockopt failed: could not attach protocol filter");
+		close(sockfd);
+		exit(EXIT_FAILURE);
+	}
 }
 
 // Sets the socket to promiscuous mode
@@ -66,6 +158,28 @@ void set_socket_promiscuous(int sockfd, int interface_index) {
 	}
 }
 
+// Stops the socket from receiving copies of the frames it sends
+void set_socket_ignore_outgoing(int sockfd) {
+	int enable = 1;
+
+	if (setsockopt(sockfd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &enable, sizeof(enable)) == -1) {
+		perror("setsockopt failed");
+		close(sockfd);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Sizes the kernel buffers so a full window fits in them
+void set_socket_buffers(int sockfd, int buffer_size) {
+	// FORCE variants ignore rmem_max/wmem_max, fall back to the capped ones without privileges
+	if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &buffer_size, sizeof(buffer_size)) == -1) {
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	}
+	if (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUFFORCE, &buffer_size, sizeof(buffer_size)) == -1) {
+		setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+	}
+}
+
 // Sets the timeout for socket operations
 void set_socket_timeout(int sockfd, int timeout_seconds) {
 	struct timeval timeout;
@@ -77,15 +191,203 @@ void set_socket_timeout(int sockfd, int timeout_seconds) {
 		close(sockfd);
 		exit(EXIT_FAILURE);
 	}
+	socket_state(sockfd).timeout_us = (int64_t)timeout_seconds * 1000000;
+}
+
+// Maps a TPACKET_V3 receive ring shared with the kernel, false if the kernel refuses it
+bool set_socket_rx_ring(int sockfd) {
+	int version = TPACKET_V3;
+	if (setsockopt(sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+		return false;
+	}
+
+	struct tpacket_req3 request;
+	memset(&request, 0, sizeof(request));
+	request.tp_block_size = RX_RING_BLOCK_SIZE;
+	request.tp_block_nr = RX_RING_BLOCKS;
+	request.tp_frame_size = RX_RING_FRAME_SIZE;
+	request.tp_frame_nr = (RX_RING_BLOCK_SIZE / RX_RING_FRAME_SIZE) * RX_RING_BLOCKS;
+	// a block that is not full is still handed over after this long, keeps acks flowing
+	request.tp_retire_blk_tov = RX_RING_RETIRE_MS;
+
+	if (setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) == -1) {
+		version = TPACKET_V1;
+		setsockopt(sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+		return false;
+	}
+
+	size_t size = (size_t)RX_RING_BLOCK_SIZE * RX_RING_BLOCKS;
+	void *ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, sockfd, 0);
+	if (ring == MAP_FAILED) {
+		memset(&request, 0, sizeof(request));
+		setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request));
+		return false;
+	}
+
+	SocketState &state = socket_state(sockfd);
+	state.ring = (uint8_t *)ring;
+	state.ring_size = size;
+	state.block = 0;
+	state.packet = nullptr;
+	state.packets_left = 0;
+	state.holding_block = false;
+	return true;
 }
 
 // Creates and configures a raw socket
 int raw_socket_create(const char *interface_name, int timeout_seconds) {
 	int sockfd = create_socket();
 	int interface_index = get_interface_index(interface_name);
+	// filter before binding so no foreign packet is ever queued
+	attach_protocol_filter(sockfd);
 	bind_socket_to_interface(sockfd, interface_index);
-	set_socket_promiscuous(sockfd, interface_index);
+	if (PROMISCUOUS == 1) {
+		set_socket_promiscuous(sockfd, interface_index);
+	}
+	set_socket_ignore_outgoing(sockfd);
+	set_socket_buffers(sockfd, SOCKET_BUFFER_SIZE);
 	set_socket_timeout(sockfd, timeout_seconds);
+	if (USE_RX_RING == 1 && !set_socket_rx_ring(sockfd)) {
+		cout << "Receive ring unavailable, falling back to recv()" << endl;
+	}
+
+	transport_register(sockfd, &raw_socket_transport);
+	return sockfd;
+}
 
+// A sender on the interface sockfd is bound to
+static int create_sender_like(int sockfd, const uint8_t *peer) {
+	int interface_index = socket_state(sockfd).peer.sll_ifindex;
+	int sender = create_socket();
+	set_socket_buffers(sender, SOCKET_BUFFER_SIZE);
+	socket_state(sender).peer.sll_ifindex = interface_index;
+	raw_socket_set_peer(sender, peer);
+	transport_register(sender, &raw_socket_transport);
+	return sender;
+}
+
+int raw_socket_create_sender(const char *interface_name, const uint8_t *peer) {
+	int sockfd = create_socket();
+	set_socket_buffers(sockfd, SOCKET_BUFFER_SIZE);
+	socket_state(sockfd).peer.sll_ifindex = get_interface_index(interface_name);
+	raw_socket_set_peer(sockfd, peer);
+	transport_register(sockfd, &raw_socket_transport);
 	return sockfd;
+}
+
+void raw_socket_close(int sockfd) {
+	{
+		lock_guard<mutex> guard(socket_states_lock);
+		auto state = socket_states.find(sockfd);
+		if (state != socket_states.end()) {
+			if (state->second.ring != nullptr) {
+				munmap(state->second.ring, state->second.ring_size);
+			}
+			socket_states.erase(state);
+		}
+	}
+	close(sockfd);
+}
+
+static struct tpacket_block_desc *ring_block(SocketState &state, unsigned int block) {
+	return (struct tpacket_block_desc *)(state.ring + (size_t)block * RX_RING_BLOCK_SIZE);
+}
+
+// Waits until the socket is readable, false on timeout
+static bool wait_readable(int sockfd, int64_t timeout_us) {
+	struct timespec timeout;
+	timeout.tv_sec = timeout_us / 1000000;
+	timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+
+	struct pollfd pfd;
+	pfd.fd = sockfd;
+	pfd.events = POLLIN | POLLERR;
+	pfd.revents = 0;
+	return ppoll(&pfd, 1, &timeout, nullptr) > 0;
+}
+
+static ssize_t ring_receive(int sockfd, SocketState &state, uint8_t **packet, int64_t timeout_us) {
+	if (state.packets_left == 0) {
+		// every packet of the block was read, give it back and move to the next one
+		if (state.holding_block) {
+			ring_block(state, state.block)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			state.block = (state.block + 1) % RX_RING_BLOCKS;
+			state.holding_block = false;
+		}
+
+		struct tpacket_block_desc *block = ring_block(state, state.block);
+		while ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+			if (!wait_readable(sockfd, timeout_us)) {
+				return -1;
+			}
+		}
+
+		state.holding_block = true;
+		state.packets_left = block->hdr.bh1.num_pkts;
+		state.packet = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+		if (state.packets_left == 0) {
+			return ring_receive(sockfd, state, packet, timeout_us);
+		}
+	} else {
+		state.packet = (struct tpacket3_hdr *)((uint8_t *)state.packet + state.packet->tp_next_offset);
+	}
+
+	state.packets_left--;
+	// the link layer address follows the packet header
+	struct sockaddr_ll *source =
+		(struct sockaddr_ll *)((uint8_t *)state.packet + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+	memcpy(state.last_source, source->sll_addr, ETH_ALEN);
+	*packet = (uint8_t *)state.packet + state.packet->tp_net;
+	return state.packet->tp_snaplen;
+}
+
+ssize_t raw_socket_receive(int sockfd, uint8_t **packet, int64_t timeout_us) {
+	SocketState &state = socket_state(sockfd);
+	if (timeout_us < 0) {
+		timeout_us = state.timeout_us;
+	}
+	if (state.ring != nullptr) {
+		return ring_receive(sockfd, state, packet, timeout_us);
+	}
+
+	// a zero timeout only takes what is already queued
+	if (timeout_us > 0 && !wait_readable(sockfd, timeout_us)) {
+		return -1;
+	}
+	struct sockaddr_ll source;
+	socklen_t source_length = sizeof(source);
+	*packet = state.buffer.data();
+	ssize_t len = recvfrom(sockfd, state.buffer.data(), state.buffer.size(), MSG_DONTWAIT,
+						   (struct sockaddr *)&source, &source_length);
+	if (len >= 0) {
+		memcpy(state.last_source, source.sll_addr, ETH_ALEN);
+	}
+	return len;
+}
+
+void raw_socket_set_peer(int sockfd, const uint8_t *mac) {
+	memcpy(socket_state(sockfd).peer.sll_addr, mac, ETH_ALEN);
+}
+
+const uint8_t *raw_socket_last_source(int sockfd) {
+	return socket_state(sockfd).last_source;
+}
+
+const struct sockaddr_ll *raw_socket_peer(int sockfd) {
+	return &socket_state(sockfd).peer;
+}
+
+void raw_socket_send_batch(int sockfd, struct mmsghdr *messages, unsigned int count) {
+	unsigned int sent = 0;
+	while (sent < count) {
+		int result = sendmmsg(sockfd, messages + sent, count - sent, 0);
+		if (result <= 0) {
+			if (result == -1 && errno == EINTR) {
+				continue;
+			}
+			// a full queue drops the rest of the batch, the protocol retransmits what is missing
+			break;
+		}
+		sent += result;
+	}
 }
\ No newline at end of file
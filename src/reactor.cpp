@@ -0,0 +1,119 @@
+#include "../inc/reactor.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#define REACTOR_EVENTS 16
+
+void reactor_init(Reactor &reactor) {
+	reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor.epoll_fd < 0) {
+		perror("Failed to create epoll instance");
+		exit(EXIT_FAILURE);
+	}
+	reactor.running = false;
+}
+
+void reactor_close(Reactor &reactor) {
+	for (int timer : reactor.timers) {
+		close(timer);
+	}
+	reactor.timers.clear();
+	reactor.handlers.clear();
+	close(reactor.epoll_fd);
+}
+
+void reactor_watch(Reactor &reactor, int fd, function<void()> handler) {
+	bool watched = reactor.handlers.count(fd) > 0;
+	reactor.handlers[fd] = move(handler);
+	if (watched) {
+		return;
+	}
+
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		perror("Failed to watch file descriptor");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void reactor_unwatch(Reactor &reactor, int fd) {
+	if (reactor.handlers.erase(fd) > 0) {
+		epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+	}
+}
+
+int reactor_create_timer(Reactor &reactor) {
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer < 0) {
+		perror("Failed to create timer");
+		exit(EXIT_FAILURE);
+	}
+	reactor.timers.insert(timer);
+	return timer;
+}
+
+void reactor_destroy_timer(Reactor &reactor, int timer) {
+	reactor_unwatch(reactor, timer);
+	reactor.timers.erase(timer);
+	close(timer);
+}
+
+void reactor_arm_timer(int timer, int64_t timeout_us) {
+	struct itimerspec spec = {};
+	if (timeout_us != TIMER_OFF) {
+		// a zero value would disarm the timer, an expired deadline fires right away instead
+		timeout_us = max<int64_t>(timeout_us, 1);
+		spec.it_value.tv_sec = timeout_us / 1000000;
+		spec.it_value.tv_nsec = (timeout_us % 1000000) * 1000;
+	}
+	if (timerfd_settime(timer, 0, &spec, nullptr) < 0) {
+		perror("Failed to arm timer");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void reactor_run(Reactor &reactor) {
+	struct epoll_event events[REACTOR_EVENTS];
+	reactor.running = true;
+
+	while (reactor.running) {
+		int count = epoll_wait(reactor.epoll_fd, events, REACTOR_EVENTS, -1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Failed to wait for events");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = 0; i < count && reactor.running; i++) {
+			int fd = events[i].data.fd;
+			if (reactor.timers.count(fd) > 0) {
+				// a timer re-armed by an earlier handler of this batch has nothing to read
+				uint64_t expirations;
+				if (read(fd, &expirations, sizeof(expirations)) < 0) {
+					continue;
+				}
+			}
+
+			// an earlier handler may have unwatched it
+			auto handler = reactor.handlers.find(fd);
+			if (handler != reactor.handlers.end()) {
+				handler->second();
+			}
+		}
+	}
+}
+
+void reactor_stop(Reactor &reactor) {
+	reactor.running = false;
+}
@@ -0,0 +1,41 @@
+#include "../inc/rtt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+int64_t now_us() {
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+void rtt_init(RttEstimator &rtt) {
+	rtt.srtt = 0;
+	rtt.rttvar = 0;
+	rtt.rto = RTO_INITIAL_US;
+	rtt.has_sample = false;
+}
+
+void rtt_sample(RttEstimator &rtt, int64_t sample_us) {
+	sample_us = max<int64_t>(sample_us, 1);
+
+	if (!rtt.has_sample) {
+		rtt.srtt = sample_us;
+		rtt.rttvar = sample_us / 2;
+		rtt.has_sample = true;
+	} else {
+		// rttvar = 3/4 rttvar + 1/4 |srtt - sample|, srtt = 7/8 srtt + 1/8 sample
+		int64_t error = rtt.srtt - sample_us;
+		rtt.rttvar += (llabs(error) - rtt.rttvar) / 4;
+		rtt.srtt += (sample_us - rtt.srtt) / 8;
+	}
+
+	// a fresh estimate also drops any backoff
+	rtt.rto = clamp<int64_t>(rtt.srtt + 4 * rtt.rttvar, RTO_MIN_US, RTO_MAX_US);
+}
+
+void rtt_backoff(RttEstimator &rtt) {
+	rtt.rto = min<int64_t>(rtt.rto * 2, RTO_MAX_US);
+}
@@ -2,175 +2,534 @@
 
 using namespace std;
 
-void handle_list_request(int sockfd, int timeout_seconds) {
-	const string directory_path = "./videos";
-	vector<string> files;
-	struct dirent *entry;
-	DIR *dp = opendir(directory_path.c_str());
+void handle_list_request(Session &session, Catalog &catalog) {
+	shared_ptr<const vector<CatalogEntry>> files;
+	shared_ptr<const vector<uint8_t>> packed;
 
-	if (dp == nullptr) {
-		Frame frame = {};
+	if (!catalog_snapshot(catalog, files, packed)) {
+		ControlFrame control = {};
+		Frame &frame = control_frame(control);
 		frame.start_marker = START_MARKER;
 		frame.length = 0;
 		frame.sequence = 0;
 		frame.type = TYPE_ERROR;
 		frame.crc = calculate_crc(frame);
-		send_frame_and_receive_ack(sockfd, frame, timeout_seconds);
+		send_frame_and_receive_ack(session, frame);
 		return;
 	}
 
-	while ((entry = readdir(dp))) {
-		if (entry->d_type == DT_REG) {	// Regular file
-			files.emplace_back(entry->d_name);
-		}
+	// the whole listing goes out like a download, many entries a frame and a window of frames
+	// in flight, so any library takes a few round trips
+	if (session.options.packed_list) {
+		FileSource listing;
+		file_source_memory(listing, packed->data(), packed->size());
+		send_file(session, listing, nullptr, false);
+		file_source_close(listing);
+		return;
 	}
-	closedir(dp);
 
-	uint8_t seq = 0;
-	for (const auto &file : files) {
+	// peers without packed listings get one name per frame
+	uint16_t seq = 0;
+	for (const CatalogEntry &file : *files) {
 		Frame frame = {};
 		frame.start_marker = START_MARKER;
-		frame.length = file.size();
 		frame.sequence = seq;
 		frame.type = TYPE_FILE_DESCRIPTOR;
-		strncpy((char *)frame.data, file.c_str(), frame.length);
+		// large descriptors also carry the size, so the client can reserve the space
+		if (session.options.format != FORMAT_LEGACY) {
+			frame.length = min<size_t>(file.name.size(), session.options.payload_size - 1 - sizeof(uint64_t));
+			strncpy((char *)frame.data, file.name.c_str(), frame.length);
+			write_file_size(frame, file.size);
+		} else {
+			frame.length = min<size_t>(file.name.size(), session.options.payload_size);
+			strncpy((char *)frame.data, file.name.c_str(), frame.length);
+		}
 		frame.crc = calculate_crc(frame);
 
-		send_frame_and_receive_ack(sockfd, frame, timeout_seconds);
+		if (!send_frame_and_receive_ack(session, frame)) {
+			return;
+		}
 		seq = (seq + 1) % MAX_SEQ;
 	}
 
-	Frame end_tx_frame = {};
+	ControlFrame control = {};
+	Frame &end_tx_frame = control_frame(control);
 	end_tx_frame.start_marker = START_MARKER;
 	end_tx_frame.length = 0;
 	end_tx_frame.sequence = seq;
 	end_tx_frame.type = TYPE_END_TX;
 	end_tx_frame.crc = calculate_crc(end_tx_frame);
 
-	send_frame_and_receive_ack(sockfd, end_tx_frame, timeout_seconds);
+	send_frame_and_receive_ack(session, end_tx_frame);
 }
 
-void send_window(int sockfd, vector<Frame> window) {
-	if (SHOW_LOGS == 1) cout << "Sending frames " << (int)window[0].sequence << " to " << (int)window[WINDOW_SIZE - 1].sequence << endl;
-	for (size_t i = 0; i < window.size(); i++) {
-		send(sockfd, &window[i], sizeof(window[i]), 0);
-		if (window[i].type == TYPE_END_TX) {
-			break;
-		}
+void send_file(Session &session, FileSource &file, const CachedFile *cached, bool stream) {
+	const int sockfd = session.sockfd;
+	const TransferOptions &options = session.options;
+	Reactor &reactor = *session.reactor;
+	// frames sent but not acked yet live in a fixed ring of slots, oldest at first_slot.
+	// A slot only holds the header, payloads are read from the file mapping on every send.
+	vector<FrameHeader> slots(WINDOW_MAX);
+	vector<const uint8_t *> payloads(WINDOW_MAX);
+	vector<const PayloadCrc *> checksums(WINDOW_MAX);  // known for payloads from the cache
+	vector<int64_t> sent_at(WINDOW_MAX);
+	vector<bool> retransmitted(WINDOW_MAX);
+	vector<bool> sacked(WINDOW_MAX);  // the receiver holds it, never sent again
+	int first_slot = 0;
+	int in_flight = 0;
+	uint64_t acked = 0;	 // frames that left the window
+	TxBatch batch;
+	tx_batch_init(batch, sockfd);
+	SendWindow window_size;
+	window_init(window_size, options.session_id);
+	uint16_t seq_num = 0;
+	Prefetcher prefetcher;
+	if (cached != nullptr) {
+		prefetcher_start_cached(prefetcher, file, *cached, options);
+	} else {
+		prefetcher_start(prefetcher, file, options);
 	}
-}
-
-void send_file(int sockfd, ifstream &file, int timeout_seconds) {
-	vector<Frame> window(WINDOW_SIZE);
-	uint8_t seq_num = 255;
 	int retries = 0;
+	int64_t last_response = now_us();
 	bool sent_end_tx = false;
-	bool got_end_ack = false;
+	bool gave_up = false;
+	FecEncoder fec;
+	if (options.fec) {
+		fec_encoder_init(fec, options.payload_size);
+	}
+	// added to session.stats once at the end, the stats are shared with other sessions
+	Metrics &metrics = *session.metrics;
+	const uint64_t frames_before = metrics.frames_sent;
+	const uint64_t retransmits_before = metrics.retransmits;
+	vector<int64_t> rtts;
 
-	int window_frame_index = 0;
+	// A player waits on the frame at the playhead, the oldest unacked one. Its retransmission
+	// is queued before any new frame, and a stream keeps few frames ahead of it so that one
+	// never waits behind a long burst in the queues of the link
+	const int ahead_limit = min(stream ? STREAM_AHEAD_FRAMES : WINDOW_MAX, session.window_limit);
 
-	while (!file.eof() || !sent_end_tx || !got_end_ack) {
-		// assemble window
-		while (window_frame_index < WINDOW_SIZE && !file.eof()) {
-			seq_num = (seq_num + 1) % MAX_SEQ;
-			Frame &frame = window[window_frame_index];
-			frame.start_marker = START_MARKER;
-			frame.sequence = seq_num;
-			frame.type = TYPE_DATA;
-			file.read((char *)frame.data, sizeof(frame.data));
-			frame.length = file.gcount();
-			frame.crc = calculate_crc(frame);
-			window_frame_index++;
-		}
-
-		// put end of transmition frame on window
-		if (file.eof() && window_frame_index < WINDOW_SIZE && !sent_end_tx) {
-			seq_num = (seq_num + 1) % MAX_SEQ;
-			Frame end_frame;
-			end_frame.start_marker = START_MARKER;
-			end_frame.sequence = seq_num;
-			end_frame.type = TYPE_END_TX;
-			end_frame.length = 0;
-			end_frame.crc = calculate_crc(end_frame);
+	// fill window with the frames the prefetcher has ready, everything queued goes out in one batch
+	auto fill_window = [&]() {
+		PreparedFrame prepared;
+		while (in_flight < min(window_frames(window_size), ahead_limit) && !sent_end_tx &&
+			   prefetcher_next(prefetcher, prepared)) {
+			int slot = (first_slot + in_flight) % WINDOW_MAX;
+			slots[slot] = prepared.header;
+			payloads[slot] = prepared.payload;
+			checksums[slot] = prepared.checksums;
+			// end of transmition frame is the last one the prefetcher makes
+			sent_end_tx = prepared.header.type == TYPE_END_TX;
 
-			window[window_frame_index] = end_frame;
-			sent_end_tx = true;
+			// parity goes out right behind the frames it covers, the last group's before the end
+			if (options.fec && sent_end_tx) {
+				fec_finish(fec, batch, options.format);
+			}
+			queue_frame(batch, slots[slot], payloads[slot], checksums[slot], options.format);
+			if (options.fec && !sent_end_tx) {
+				fec_add(fec, batch, slots[slot], payloads[slot], options.format);
+			}
+			sent_at[slot] = now_us();
+			retransmitted[slot] = false;
+			sacked[slot] = false;
+			in_flight++;
+			metric_add(metrics.frames_sent);
+			trace_event(TRACE_SENT, prepared.header.session, prepared.header.sequence, in_flight);
+			seq_num = (seq_num + 1) % MAX_SEQ;
 		}
+		flush_frames(batch);
+		// nothing acked is queued any more, compressed payloads can go
+		prefetcher_release(prefetcher, acked);
+		histogram_add(metrics.window_frames, in_flight);
 
-		send_window(sockfd, window);
+		// the retransmission timer runs on the oldest unacked frame
+		if (in_flight > 0) {
+			reactor_arm_timer(session.timer, sent_at[first_slot] + session.rtt.rto - now_us());
+		} else if (sent_end_tx) {
+			reactor_stop(reactor);
+		} else {
+			// everything sent is acked and the prefetcher is behind, nothing to time out on
+			reactor_arm_timer(session.timer, TIMER_OFF);
+		}
+	};
 
+	auto resend = [&](int slot) {
+		trace_event(TRACE_RESENT, slots[slot].session, slots[slot].sequence, slots[slot].type);
+		queue_frame(batch, slots[slot], payloads[slot], checksums[slot], options.format);
+		sent_at[slot] = now_us();
+		retransmitted[slot] = true;
+		metric_add(metrics.frames_sent);
+		metric_add(metrics.retransmits);
+		if (options.fec) {
+			fec_on_loss(fec, 1);
+		}
+	};
 
-		Frame response;
-		bool response_received = receive_frame_with_timeout(sockfd, response, timeout_seconds);
+	// cumulative ack: everything up to the acked sequence arrived. Only frames sent once
+	// give a round trip sample, an ack for a retransmitted one is ambiguous
+	auto acknowledge = [&](int offset, uint16_t sequence) {
+		int slot = (first_slot + offset) % WINDOW_MAX;
+		if (!retransmitted[slot]) {
+			rtt_sample(session.rtt, last_response - sent_at[slot]);
+			histogram_add(metrics.rtt_us, last_response - sent_at[slot]);
+			if (session.stats != nullptr) {
+				rtts.push_back(last_response - sent_at[slot]);
+			}
+		}
+		first_slot = (first_slot + offset + 1) % WINDOW_MAX;
+		in_flight -= offset + 1;
+		acked += offset + 1;
+		window_on_ack(window_size, sequence, offset + 1);
+	};
 
-		if(!response_received) {
-			if (SHOW_LOGS == 1) cout << "Timed out, resending window" << endl;
-			retries++;
-			if (retries > MAX_RETIES) {
-				cout << "Max retries reached. Terminating connection" << endl;
-				file.close();
-				return;
+	// Frames the SACK covers are dropped from retransmission. A frame still missing that was
+	// sent before one the receiver holds is lost, and resent once: after that it was sent last
+	auto handle_sack = [&](const Frame &sack) {
+		// without a bitmap nothing past the cumulative point arrived, so nothing is known lost
+		if (sack.length <= SACK_BITMAP_OFFSET) {
+			return;
+		}
+		int64_t newest = -1;
+		for (int i = 0; i < in_flight; i++) {
+			int slot = (first_slot + i) % WINDOW_MAX;
+			sacked[slot] = sacked[slot] || sack_covers(sack, slots[slot].sequence);
+			if (sacked[slot]) {
+				newest = max(newest, sent_at[slot]);
 			}
-			continue;
-		} else {
-			retries = 0;
 		}
 
-		if (response.type == TYPE_NACK) {
-			// move window
-			uint8_t nack_seq = response.sequence;
-			uint8_t nack_index = INT8_MAX;
-			for (size_t i = 0; i < window.size(); i++) {
-				if (window[i].sequence == nack_seq) {
-					nack_index = i;
-					break;
+		bool lost = false;
+		for (int i = 0; i < in_flight; i++) {
+			int slot = (first_slot + i) % WINDOW_MAX;
+			if (!sacked[slot] && sent_at[slot] < newest) {
+				if (!lost) {
+					window_on_loss(window_size, slots[slot].sequence, seq_num);
 				}
+				resend(slot);
+				lost = true;
 			}
+		}
+	};
 
-			vector<Frame> new_window(WINDOW_SIZE);
-			window_frame_index = 0;
-			for (size_t i = nack_index, j = 0; i < window.size(); i++, j++) {
-				new_window[j] = window[i];
-				window_frame_index = j + 1;
+	auto handle_response = [&](const Frame &response) {
+		if (response.type != TYPE_ACK && response.type != TYPE_NACK && response.type != TYPE_SACK) {
+			return;
+		}
+		retries = 0;
+		last_response = now_us();
+
+		int offset = seq_offset(slots[first_slot].sequence, response.sequence);
+		if (response.type == TYPE_SACK) {
+			// the cumulative point is behind the window until the first frame arrived
+			if (offset < in_flight) {
+				acknowledge(offset, response.sequence);
 			}
-			window = new_window;
-		} else if (response.type == TYPE_ACK && response.sequence == seq_num) {
-			window_frame_index = 0;
-			if (sent_end_tx) {
-				got_end_ack = true;
+			if (options.fec) {
+				fec_on_loss(fec, sack_recovered(response));
 			}
+			handle_sack(response);
+			return;
 		}
-	}
+		if (offset >= in_flight) {
+			// stale response for a frame that already left the window
+			return;
+		}
+
+		if (response.type == TYPE_NACK) {
+			// selective repeat: resend only the frame that is missing
+			resend((first_slot + offset) % WINDOW_MAX);
+			window_on_loss(window_size, response.sequence, seq_num);
+		} else {
+			acknowledge(offset, response.sequence);
+		}
+	};
+
+	// every response already received is handled before the window is refilled
+	reactor_watch(reactor, session_fd(session), [&]() {
+		const Frame *response;
+		while ((response = session_receive(session)) != nullptr) {
+			if (frame_intact(*response)) {
+				handle_response(*response);
+			}
+		}
+		if (session_closed(session)) {
+			cout << "Client moved on, transfer abandoned" << endl;
+			gave_up = true;
+			reactor_stop(reactor);
+			return;
+		}
+		fill_window();
+	});
+
+	// the prefetcher caught up after the window was left short
+	reactor_watch(reactor, prefetcher.ready_fd, [&]() {
+		uint64_t count;
+		if (read(prefetcher.ready_fd, &count, sizeof(count)) > 0) {
+			fill_window();
+		}
+	});
+
+	reactor_watch(reactor, session.timer, [&]() {
+		// an expiry already due when the window emptied, its frame is acked
+		if (in_flight == 0) {
+			return;
+		}
+		// only the oldest unacked frame is retransmitted, the rest may still arrive
+		FrameHeader &oldest = slots[first_slot];
+		retries++;
+		rtt_backoff(session.rtt);
+		window_on_timeout(window_size, oldest.sequence);
+		if (retries > MAX_RETIES && now_us() - last_response >= session.timeout_seconds * 1000000LL) {
+			cout << "Max retries reached. Terminating connection" << endl;
+			gave_up = true;
+			reactor_stop(reactor);
+			return;
+		}
+		trace_event(TRACE_TIMEOUT, oldest.session, oldest.sequence, session.rtt.rto);
+		queue_frame(batch, oldest, payloads[first_slot], checksums[first_slot], options.format);
+		sent_at[first_slot] = now_us();
+		retransmitted[first_slot] = true;
+		metric_add(metrics.frames_sent);
+		metric_add(metrics.retransmits);
+		metric_add(metrics.timeouts);
+		if (options.fec) {
+			fec_on_loss(fec, 1);
+		}
+		fill_window();
+	});
+
+	fill_window();
+	reactor_run(reactor);
+	reactor_arm_timer(session.timer, TIMER_OFF);
+	reactor_unwatch(reactor, session_fd(session));
+	reactor_unwatch(reactor, prefetcher.ready_fd);
+	reactor_unwatch(reactor, session.timer);
+	prefetcher_stop(prefetcher);
 
+	if (session.stats != nullptr) {
+		lock_guard<mutex> guard(session.stats->lock);
+		session.stats->frames_sent += metrics.frames_sent - frames_before;
+		session.stats->retransmits += metrics.retransmits - retransmits_before;
+		session.stats->rtts.insert(session.stats->rtts.end(), rtts.begin(), rtts.end());
+	}
+	if (gave_up) {
+		return;
+	}
+	cout << "Transfer done, window peaked at " << window_size.max_size << " frames, smoothed RTT "
+		 << session.rtt.srtt << "us" << endl;
 }
 
-void handle_download_request(int sockfd, const Frame &frame, int timeout_seconds) {
-	string filename((char *)frame.data, frame.length);
-	ifstream file("./videos/" + filename, ios::binary);
-	cout << "Sending " << "./videos/" << filename << endl;
+void handle_download_request(Session &session, const Frame &frame, FrameCache &cache) {
+	string filename = request_filename(frame);
+	// peers that can't ask for a range get the whole file
+	ByteRange range = session.options.ranges ? request_range(frame) : ByteRange{0, 0};
+	bool stream = frame.type == TYPE_SHOWS_ON_SCREEN;
+	// a compressed range starts a stream of blocks of its own, only whole files are cached so
+	shared_ptr<const CachedFile> cached;
+	if (!session.options.compressed || (range.offset == 0 && range.length == 0)) {
+		cached = frame_cache_find(cache, filename, session.options.payload_size,
+								  session.options.compressed);
+	}
+	FileSource file;
+	cout << "Sending " << "./videos/" << filename << " (" << session.options.payload_size
+		 << " byte frames" << (session.options.compressed ? ", compressed" : "")
+		 << (cached != nullptr ? ", cached)" : ")") << endl;
+	if (range.offset != 0) {
+		cout << "Starting at byte " << range.offset << endl;
+	}
 
-	if (file.is_open()) {
-		send_file(sockfd, file, timeout_seconds);
-		file.close();
+	if (cached != nullptr && range.offset <= cached->bytes.size()) {
+		size_t size = cached->bytes.size() - range.offset;
+		if (range.length > 0) {
+			size = min<uint64_t>(size, range.length);
+		}
+		file_source_memory(file, cached->bytes.data() + range.offset, size);
+		send_file(session, file, cached.get(), stream);
+	} else if (file_source_open(file, "./videos/" + filename, range.offset, range.length)) {
+		send_file(session, file, nullptr, stream);
+		file_source_close(file);
 	} else {
 		cout << "Failed to open file: " << filename << endl;
-		Frame error_frame;
+		ControlFrame control = {};
+		Frame &error_frame = control_frame(control);
 		error_frame.start_marker = START_MARKER;
 		error_frame.length = 0;
 		error_frame.sequence = 0;
 		error_frame.type = TYPE_ERROR;
 		error_frame.crc = calculate_crc(error_frame);
 
-		send_frame_and_receive_ack(sockfd, error_frame, timeout_seconds);
+		send_frame_and_receive_ack(session, error_frame);
 	}
 }
 
-void listen_for_requests(int sockfd, Frame &request) {
-	cout << "Listening for requests..." << endl;
-	while (true) {
-		ssize_t bytes_received = recv(sockfd, (void*) &request, sizeof(Frame), 0);
-		if (bytes_received > 0 && request.start_marker == START_MARKER) {
+void acknowledge_request(int sockfd, const Frame &request, const TransferOptions &options) {
+	ControlFrame control = {};
+	Frame &ack = control_frame(control);
+	ack.start_marker = START_MARKER;
+	ack.session = options.session_id;
+	ack.length = 0;
+	ack.sequence = request.sequence;
+	ack.type = TYPE_ACK;
+	write_options(ack, options);
+	ack.crc = calculate_crc(ack);
+
+	// clients read both formats, legacy ones never offer anything else
+	send_frame(sockfd, ack, options.format);
+}
+
+void dispatcher_init(Dispatcher &dispatcher, int sockfd, int timeout_seconds,
+					 const TransferOptions &local, WorkerPool &pool) {
+	dispatcher.sockfd = sockfd;
+	dispatcher.timeout_seconds = timeout_seconds;
+	dispatcher.local = local;
+	dispatcher.pool = &pool;
+	dispatcher.window_limit = WINDOW_MAX;
+	dispatcher.stats = nullptr;
+	catalog_open(dispatcher.catalog, "./videos");
+	frame_cache_open(dispatcher.cache, "./videos", FRAME_CACHE_BYTES);
+}
+
+// Listings always shrink, a file only goes compressed when samples of it do. Streams never
+// are, their first bytes would wait for a whole block. A whole file the cache holds was
+// sampled when it was read in
+static bool worth_compressing(const Frame &request, const TransferOptions &options,
+							  FrameCache &cache) {
+	if (request.type == TYPE_LIST) {
+		return options.packed_list;
+	}
+	if (request.type != TYPE_DOWNLOAD) {
+		return false;
+	}
+	ByteRange range = options.ranges ? request_range(request) : ByteRange{0, 0};
+	bool worth;
+	if (range.offset == 0 && range.length == 0 &&
+		frame_cache_compressible(cache, request_filename(request), options.payload_size, worth)) {
+		return worth;
+	}
+	FileSource file;
+	if (!file_source_open(file, "./videos/" + request_filename(request), range.offset,
+						  range.length)) {
+		return false;
+	}
+	worth = compress_sample(file.data, file.size) <= COMPRESS_MAX_RATIO;
+	file_source_close(file);
+	return worth;
+}
+
+// client MAC in the high bits, session id in the low ones
+static uint64_t session_key(const uint8_t *mac, uint16_t session_id) {
+	uint64_t key = 0;
+	for (int i = 0; i < ETH_ALEN; i++) {
+		key = (key << 8) | mac[i];
+	}
+	return (key << 16) | session_id;
+}
+
+static bool same_request(const Frame &a, const Frame &b) {
+	return a.type == b.type && a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+}
+
+// Runs on a worker until the request is served, then forgets the session. Whether the transfer
+// goes compressed is decided here, reading samples of the file would hold up the dispatcher
+static void serve_session(Dispatcher &dispatcher, uint64_t key, shared_ptr<ServerSession> client,
+						  Reactor &reactor) {
+	bool compressed = client->options.compression &&
+					  worth_compressing(client->request, client->options, dispatcher.cache);
+	{
+		lock_guard<mutex> guard(dispatcher.lock);
+		client->options.compressed = compressed;
+		client->acked = true;
+		acknowledge_request(client->sockfd, client->request, client->options);
+	}
+
+	Session session;
+	session_init(session, reactor, client->sockfd, dispatcher.timeout_seconds, client->options);
+	session.inbox = &client->inbox;
+	session.window_limit = dispatcher.window_limit;
+	// what is measured is files going out, not listings
+	session.stats = client->request.type != TYPE_LIST ? dispatcher.stats : nullptr;
+
+	if (client->request.type == TYPE_LIST) {
+		cout << "Got list request" << endl;
+		handle_list_request(session, dispatcher.catalog);
+	} else {
+		cout << (client->request.type == TYPE_SHOWS_ON_SCREEN ? "Got stream request"
+															   : "Got download request")
+			 << endl;
+		handle_download_request(session, client->request, dispatcher.cache);
+	}
+	session_close(session);
+
+	// removed before the socket closes, the dispatcher may still be acking a repeated request
+	{
+		lock_guard<mutex> guard(dispatcher.lock);
+		auto entry = dispatcher.sessions.find(key);
+		if (entry != dispatcher.sessions.end() && entry->second == client) {
+			dispatcher.sessions.erase(entry);
+		}
+	}
+	inbox_close(client->inbox);
+	transport_close(client->sockfd);
+}
+
+static void route_frame(Dispatcher &dispatcher, const Frame &frame, const uint8_t *source) {
+	bool request = frame.type == TYPE_LIST || frame.type == TYPE_DOWNLOAD ||
+				   frame.type == TYPE_SHOWS_ON_SCREEN;
+	// requests may come in legacy format, their session id travels in the options
+	TransferOptions options = dispatcher.local;
+	uint16_t session_id = frame.session;
+	if (request) {
+		options = negotiate_options(dispatcher.local, request_options(frame));
+		session_id = options.session_id;
+	}
+	uint64_t key = session_key(source, session_id);
+
+	lock_guard<mutex> guard(dispatcher.lock);
+	auto entry = dispatcher.sessions.find(key);
+	if (!request) {
+		// answers for sessions that are already gone are dropped
+		if (entry != dispatcher.sessions.end()) {
+			inbox_push(entry->second->inbox, frame);
+		}
+		return;
+	}
+
+	if (entry != dispatcher.sessions.end()) {
+		if (same_request(entry->second->request, frame)) {
+			// the client didn't get our ack, one is still to come when the worker hasn't started
+			if (entry->second->acked) {
+				acknowledge_request(entry->second->sockfd, frame, entry->second->options);
+			}
 			return;
 		}
+		// only legacy clients reuse a session key, a new request means they are done with the old one
+		inbox_shutdown(entry->second->inbox);
+		dispatcher.sessions.erase(entry);
 	}
-}
\ No newline at end of file
+
+	shared_ptr<ServerSession> client = make_shared<ServerSession>();
+	copy_frame(client->request, frame);
+	client->options = options;
+	client->sockfd = transport_create_sender(dispatcher.sockfd, source);
+	inbox_init(client->inbox);
+	client->acked = false;
+	dispatcher.sessions[key] = client;
+
+	pool_submit(*dispatcher.pool, [&dispatcher, key, client](Reactor &reactor) {
+		serve_session(dispatcher, key, client, reactor);
+	});
+}
+
+void dispatch_requests(Dispatcher &dispatcher, Reactor &reactor) {
+	cout << "Listening for requests..." << endl;
+	// sleeps in epoll until something arrives
+	reactor_watch(reactor, dispatcher.sockfd, [&]() {
+		const Frame *frame;
+		while ((frame = receive_frame_view(dispatcher.sockfd, 0)) != nullptr) {
+			if (frame_intact(*frame)) {
+				route_frame(dispatcher, *frame, transport_last_source(dispatcher.sockfd));
+			}
+		}
+	});
+	reactor_run(reactor);
+	reactor_unwatch(reactor, dispatcher.sockfd);
+}
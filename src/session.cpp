@@ -0,0 +1,251 @@
+#include "../inc/session.h"
+
+using namespace std;
+
+void session_init(Session &session, Reactor &reactor, int sockfd, int timeout_seconds,
+				  const TransferOptions &options) {
+	session.reactor = &reactor;
+	session.timer = reactor_create_timer(reactor);
+	session.sockfd = sockfd;
+	session.inbox = nullptr;
+	session.timeout_seconds = timeout_seconds;
+	session.options = options;
+	rtt_init(session.rtt);
+	session.window_limit = WINDOW_MAX;
+	session.stats = nullptr;
+	session.metrics = metrics_open();
+}
+
+void session_close(Session &session) {
+	reactor_destroy_timer(*session.reactor, session.timer);
+	metrics_close(session.metrics);
+}
+
+int session_fd(const Session &session) {
+	return session.inbox != nullptr ? session.inbox->event_fd : session.sockfd;
+}
+
+// Every frame a session gets goes through here, so this is where they are counted
+static const Frame *count_received(Session &session, const Frame *frame) {
+	if (frame == nullptr) {
+		return nullptr;
+	}
+	metric_add(session.metrics->frames_received);
+	if (!frame_intact(*frame)) {
+		metric_add(session.metrics->crc_failures);
+		trace_event(TRACE_CORRUPT, session.options.session_id, frame->sequence, frame->type);
+	}
+	return frame;
+}
+
+const Frame *session_receive(Session &session) {
+	if (session.inbox != nullptr) {
+		return count_received(session, inbox_pop(*session.inbox));
+	}
+
+	// legacy frames carry no session, they can only come from a legacy session
+	const Frame *frame;
+	while ((frame = receive_frame_view(session.sockfd, 0)) != nullptr) {
+		if (frame->session == session.options.session_id || frame->session == 0) {
+			return count_received(session, frame);
+		}
+	}
+	return nullptr;
+}
+
+bool session_closed(const Session &session) {
+	return session.inbox != nullptr && session.inbox->closed;
+}
+
+
+// Send a frame until gets ack
+bool send_frame_and_receive_ack(Session &session, Frame &frame) {
+	Frame ack;
+	return send_frame_and_receive_ack(session, frame, ack);
+}
+
+bool send_frame_and_receive_ack(Session &session, Frame &frame, Frame &ack) {
+	Reactor &reactor = *session.reactor;
+	int64_t sent_at = 0;
+	int64_t last_response = now_us();
+	bool retransmitted = false;
+	bool acked = false;
+	int retries = 0;
+
+	frame.session = session.options.session_id;
+	frame.crc = calculate_crc(frame);
+
+	auto transmit = [&]() {
+		send_frame(session.sockfd, frame, session.options.format);
+		metric_add(session.metrics->frames_sent);
+		sent_at = now_us();
+		reactor_arm_timer(session.timer, session.rtt.rto);
+	};
+
+	reactor_watch(reactor, session_fd(session), [&]() {
+		const Frame *response;
+		while ((response = session_receive(session)) != nullptr) {
+			if (response->type == TYPE_NACK && response->sequence == frame.sequence) {
+				last_response = now_us();
+				retransmitted = true;
+				transmit();
+				metric_add(session.metrics->retransmits);
+				trace_event(TRACE_RESENT, frame.session, frame.sequence, frame.type);
+			} else if (response->type == TYPE_ACK && response->sequence == frame.sequence) {
+				// an ack after a retransmission could belong to either copy, don't measure it
+				if (!retransmitted) {
+					rtt_sample(session.rtt, now_us() - sent_at);
+					histogram_add(session.metrics->rtt_us, now_us() - sent_at);
+				}
+				copy_frame(ack, *response);
+				acked = true;
+				reactor_stop(reactor);
+				return;
+			}
+		}
+		if (session_closed(session)) {
+			reactor_stop(reactor);
+		}
+	});
+	reactor_watch(reactor, session.timer, [&]() {
+		retries++;
+		if (retries > MAX_RETIES && now_us() - last_response >= session.timeout_seconds * 1000000LL) {
+			cout << "Max retries reached. Terminating connection" << endl;
+			reactor_stop(reactor);
+			return;
+		}
+		rtt_backoff(session.rtt);
+		retransmitted = true;
+		transmit();
+		metric_add(session.metrics->retransmits);
+		metric_add(session.metrics->timeouts);
+		trace_event(TRACE_TIMEOUT, frame.session, frame.sequence, session.rtt.rto);
+	});
+
+	transmit();
+	reactor_run(reactor);
+	reactor_arm_timer(session.timer, TIMER_OFF);
+	reactor_unwatch(reactor, session_fd(session));
+	reactor_unwatch(reactor, session.timer);
+	return acked;
+}
+
+
+// receive a frame until its right and send ack
+bool receive_frame_and_send_ack(Session &session, uint16_t seq, Frame &frame) {
+	Reactor &reactor = *session.reactor;
+	bool received = false;
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<> dist(1, ERRORS_FREQ_LIST);
+
+	reactor_watch(reactor, session_fd(session), [&]() {
+		const Frame *candidate;
+		while ((candidate = session_receive(session)) != nullptr) {
+			int rand = TEST_ERRORS == 1 ? dist(gen) : -1;
+
+			if (!frame_intact(*candidate) || candidate->sequence != seq || rand == 1) {
+				send_nack(session, seq);
+			} else {
+				copy_frame(frame, *candidate);
+				send_ack(session, seq);
+				received = true;
+				reactor_stop(reactor);
+				return;
+			}
+		}
+		if (session_closed(session)) {
+			reactor_stop(reactor);
+		} else {
+			reactor_arm_timer(session.timer, session.timeout_seconds * 1000000LL);
+		}
+	});
+	// the sender retransmits on its own, only a silent one is given up on
+	reactor_watch(reactor, session.timer, [&]() {
+		cout << "Peer stopped responding" << endl;
+		reactor_stop(reactor);
+	});
+
+	reactor_arm_timer(session.timer, session.timeout_seconds * 1000000LL);
+	reactor_run(reactor);
+	reactor_arm_timer(session.timer, TIMER_OFF);
+	reactor_unwatch(reactor, session_fd(session));
+	reactor_unwatch(reactor, session.timer);
+	return received;
+}
+
+
+void send_ack(Session &session, uint16_t sequence) {
+	ControlFrame control;
+	Frame &ack = control_frame(control);
+	ack.start_marker = START_MARKER;
+	ack.type = TYPE_ACK;
+	ack.session = session.options.session_id;
+	ack.length = 0;
+	ack.sequence = sequence;
+	ack.crc = calculate_crc(ack);
+
+	send_frame(session.sockfd, ack, session.options.format);
+	metric_add(session.metrics->frames_sent);
+}
+
+void send_nack(Session &session, uint16_t sequence) {
+	ControlFrame control;
+	Frame &nack = control_frame(control);
+	nack.start_marker = START_MARKER;
+	nack.type = TYPE_NACK;
+	nack.session = session.options.session_id;
+	nack.length = 0;
+	nack.sequence = sequence;
+	nack.crc = calculate_crc(nack);
+
+	send_frame(session.sockfd, nack, session.options.format);
+	metric_add(session.metrics->frames_sent);
+	metric_add(session.metrics->nacks);
+	trace_event(TRACE_NACK, nack.session, sequence, 0);
+}
+
+static_assert(SACK_BITMAP_OFFSET + WINDOW_MAX / 8 <= CONTROL_DATA_SIZE,
+			  "a SACK must fit a ControlFrame");
+
+// the bitmap starts at cumulative + 2, cumulative + 1 is missing or it would be acked
+void send_sack(Session &session, uint16_t cumulative, const vector<bool> &received,
+			   int first_slot, int count, uint8_t recovered) {
+	ControlFrame control;
+	Frame &sack = control_frame(control);
+	sack.start_marker = START_MARKER;
+	sack.type = TYPE_SACK;
+	sack.session = session.options.session_id;
+	sack.length = SACK_BITMAP_OFFSET;
+	sack.sequence = cumulative;
+	sack.data[0] = recovered;
+
+	uint8_t *bitmap = sack.data + SACK_BITMAP_OFFSET;
+	int bits = min<int>(count, (session.options.payload_size - SACK_BITMAP_OFFSET) * 8);
+	memset(bitmap, 0, (bits + 7) / 8);
+	for (int i = 0; i < bits; i++) {
+		if (received[(first_slot + 1 + i) % received.size()]) {
+			bitmap[i / 8] |= 1 << (i % 8);
+			sack.length = SACK_BITMAP_OFFSET + i / 8 + 1;
+		}
+	}
+	sack.crc = calculate_crc(sack);
+
+	send_frame(session.sockfd, sack, session.options.format);
+	metric_add(session.metrics->frames_sent);
+}
+
+bool sack_covers(const Frame &sack, uint16_t sequence) {
+	int offset = seq_offset(sack.sequence, sequence);
+	if (offset == 0 || offset >= MAX_SEQ / 2) {
+		return true;
+	}
+	int bit = offset - 2;
+	const uint8_t *bitmap = sack.data + SACK_BITMAP_OFFSET;
+	return bit >= 0 && bit < (sack.length - SACK_BITMAP_OFFSET) * 8 &&
+		   (bitmap[bit / 8] & (1 << (bit % 8)));
+}
+
+uint8_t sack_recovered(const Frame &sack) {
+	return sack.length >= SACK_BITMAP_OFFSET ? sack.data[0] : 0;
+}
@@ -0,0 +1,298 @@
+#include "../inc/sim-network.h"
+
+#include <net/ethernet.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <unordered_map>
+
+#include "../inc/rtt.h"
+
+// A packet on its way, with who sent it
+struct SimPacket {
+	vector<uint8_t> bytes;
+	uint8_t source[ETH_ALEN];
+};
+
+// One end of the simulated link. Its descriptor is a timerfd set to when the next packet
+// is due, so it polls readable exactly while one can be received
+struct SimEndpoint {
+	int fd;
+	SimNetwork *network;
+	uint8_t mac[ETH_ALEN];
+	struct sockaddr_ll peer;
+	uint8_t last_source[ETH_ALEN];
+	int64_t timeout_us;
+	mt19937 rng;
+	multimap<int64_t, SimPacket> queue;	 // by due time, packets due together keep their order
+	int64_t armed_due;					 // when the timer fires, 0 when disarmed
+	int64_t link_free_at;				 // the link into this endpoint is busy until then
+	vector<uint8_t> received;			 // packet handed out by the last receive
+};
+
+static unordered_map<int, unique_ptr<SimEndpoint>> endpoints;
+static mutex endpoints_lock;
+
+static SimEndpoint &sim_endpoint(int fd) {
+	lock_guard<mutex> guard(endpoints_lock);
+	return *endpoints.at(fd);
+}
+
+SimConfig sim_config_perfect() {
+	SimConfig config;
+	config.latency_us = 0;
+	config.bandwidth_bps = 0;
+	config.queue_bytes = SOCKET_BUFFER_SIZE;
+	config.loss = 0;
+	config.reorder = 0;
+	config.reorder_us = 0;
+	config.duplicate = 0;
+	config.corrupt = 0;
+	config.seed = 1;
+	return config;
+}
+
+void sim_network_init(SimNetwork &network, const SimConfig &config) {
+	network.config = config;
+	network.stats = {};
+	network.receivers.clear();
+	network.endpoints = 0;
+}
+
+SimStats sim_network_stats(SimNetwork &network) {
+	lock_guard<mutex> guard(network.lock);
+	return network.stats;
+}
+
+// Fires when due comes, the network lock is held
+static void arm(SimEndpoint &endpoint, int64_t due) {
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = due / 1000000;
+	spec.it_value.tv_nsec = (due % 1000000) * 1000;
+	if (timerfd_settime(endpoint.fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+		perror("Failed to arm simulated endpoint");
+		exit(EXIT_FAILURE);
+	}
+	endpoint.armed_due = due;
+}
+
+// Puts packet on the link into to, or drops it, as the link model and the sender's generator
+// decide. The network lock is held
+static void deliver(SimNetwork &network, SimEndpoint &from, SimEndpoint &to,
+					const vector<uint8_t> &bytes) {
+	const SimConfig &config = network.config;
+	uniform_real_distribution<double> chance(0, 1);
+	network.stats.sent++;
+	if (chance(from.rng) < config.loss) {
+		network.stats.lost++;
+		return;
+	}
+
+	// packets queue for the bandwidth of the link, the tail is dropped once the queue is full
+	int64_t now = now_us();
+	int64_t departs = max(now, to.link_free_at);
+	if (config.bandwidth_bps > 0) {
+		int64_t queued_bytes = (departs - now) * config.bandwidth_bps / 8000000;
+		if (queued_bytes + (int64_t)bytes.size() > config.queue_bytes) {
+			network.stats.queue_drops++;
+			return;
+		}
+		departs += (int64_t)bytes.size() * 8000000 / config.bandwidth_bps;
+		to.link_free_at = departs;
+	}
+	int64_t due = departs + config.latency_us;
+	if (chance(from.rng) < config.reorder) {
+		network.stats.reordered++;
+		due += uniform_int_distribution<int64_t>(1, max<int64_t>(config.reorder_us, 1))(from.rng);
+	}
+
+	int copies = 1;
+	if (chance(from.rng) < config.duplicate) {
+		network.stats.duplicated++;
+		copies = 2;
+	}
+	for (int i = 0; i < copies; i++) {
+		SimPacket packet;
+		packet.bytes = bytes;
+		memcpy(packet.source, from.mac, ETH_ALEN);
+		if (chance(from.rng) < config.corrupt && !packet.bytes.empty()) {
+			network.stats.corrupted++;
+			size_t bit = uniform_int_distribution<size_t>(0, packet.bytes.size() * 8 - 1)(from.rng);
+			packet.bytes[bit / 8] ^= 1 << (bit % 8);
+		}
+		to.queue.emplace(due + i, move(packet));
+	}
+	if (to.armed_due == 0 || due < to.armed_due) {
+		arm(to, due);
+	}
+}
+
+static ssize_t sim_receive(int fd, uint8_t **packet, int64_t timeout_us) {
+	SimEndpoint &endpoint = sim_endpoint(fd);
+	SimNetwork &network = *endpoint.network;
+	if (timeout_us < 0) {
+		timeout_us = endpoint.timeout_us;
+	}
+	int64_t deadline = now_us() + timeout_us;
+
+	while (true) {
+		{
+			lock_guard<mutex> guard(network.lock);
+			auto next = endpoint.queue.begin();
+			if (next != endpoint.queue.end() && next->first <= now_us()) {
+				endpoint.received = move(next->second.bytes);
+				memcpy(endpoint.last_source, next->second.source, ETH_ALEN);
+				endpoint.queue.erase(next);
+				*packet = endpoint.received.data();
+				return endpoint.received.size();
+			}
+
+			// nothing is due, stop polling readable until the next packet is
+			uint64_t expirations;
+			if (read(fd, &expirations, sizeof(expirations)) < 0) {
+				// the timer had not fired
+			}
+			endpoint.armed_due = 0;
+			if (next != endpoint.queue.end()) {
+				arm(endpoint, next->first);
+			}
+		}
+
+		int64_t wait_us = deadline - now_us();
+		if (timeout_us == 0 || wait_us <= 0) {
+			return -1;
+		}
+		struct pollfd pfd = {fd, POLLIN, 0};
+		struct timespec timeout = {(time_t)(wait_us / 1000000), (long)(wait_us % 1000000) * 1000};
+		ppoll(&pfd, 1, &timeout, nullptr);
+	}
+}
+
+static void sim_send_batch(int fd, struct mmsghdr *messages, unsigned int count) {
+	SimEndpoint &from = sim_endpoint(fd);
+	SimNetwork &network = *from.network;
+	static const uint8_t broadcast[ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+	lock_guard<mutex> guard(network.lock);
+	for (unsigned int i = 0; i < count; i++) {
+		const struct msghdr &message = messages[i].msg_hdr;
+		vector<uint8_t> bytes;
+		for (size_t j = 0; j < message.msg_iovlen; j++) {
+			const uint8_t *base = (const uint8_t *)message.msg_iov[j].iov_base;
+			bytes.insert(bytes.end(), base, base + message.msg_iov[j].iov_len);
+		}
+
+		const uint8_t *destination = ((const struct sockaddr_ll *)message.msg_name)->sll_addr;
+		bool to_all = memcmp(destination, broadcast, ETH_ALEN) == 0;
+		for (SimEndpoint *to : network.receivers) {
+			// like PACKET_IGNORE_OUTGOING, a host never hears itself
+			if (memcmp(to->mac, from.mac, ETH_ALEN) != 0 &&
+				(to_all || memcmp(to->mac, destination, ETH_ALEN) == 0)) {
+				deliver(network, from, *to, bytes);
+			}
+		}
+	}
+}
+
+static SimEndpoint &add_endpoint(SimNetwork &network, const uint8_t *mac, int timeout_seconds) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		perror("Failed to create simulated endpoint");
+		exit(EXIT_FAILURE);
+	}
+
+	unique_ptr<SimEndpoint> endpoint(new SimEndpoint());
+	endpoint->fd = fd;
+	endpoint->network = &network;
+	memcpy(endpoint->mac, mac, ETH_ALEN);
+	memset(&endpoint->peer, 0, sizeof(endpoint->peer));
+	endpoint->peer.sll_family = AF_PACKET;
+	endpoint->peer.sll_halen = ETH_ALEN;
+	memset(endpoint->peer.sll_addr, 0xFF, ETH_ALEN);
+	memset(endpoint->last_source, 0, ETH_ALEN);
+	endpoint->timeout_us = (int64_t)timeout_seconds * 1000000;
+	endpoint->armed_due = 0;
+	endpoint->link_free_at = 0;
+	{
+		lock_guard<mutex> guard(network.lock);
+		endpoint->rng.seed(network.config.seed + network.endpoints++);
+	}
+
+	SimEndpoint &added = *endpoint;
+	{
+		lock_guard<mutex> guard(endpoints_lock);
+		endpoints[fd] = move(endpoint);
+	}
+	return added;
+}
+
+static int sim_create_sender(int fd, const uint8_t *peer);
+static void sim_set_peer(int fd, const uint8_t *mac);
+static const uint8_t *sim_last_source(int fd);
+static const struct sockaddr_ll *sim_peer(int fd);
+static void sim_close(int fd);
+
+static const TransportOps sim_transport = {
+	sim_receive,	 sim_send_batch, sim_create_sender, sim_set_peer,
+	sim_last_source, sim_peer,		 sim_close,
+};
+
+int sim_endpoint_create(SimNetwork &network, const uint8_t *mac, int timeout_seconds) {
+	SimEndpoint &endpoint = add_endpoint(network, mac, timeout_seconds);
+	{
+		lock_guard<mutex> guard(network.lock);
+		network.receivers.push_back(&endpoint);
+	}
+	transport_register(endpoint.fd, &sim_transport);
+	return endpoint.fd;
+}
+
+// Senders share the address of the endpoint they come from and receive nothing
+static int sim_create_sender(int fd, const uint8_t *peer) {
+	SimEndpoint &from = sim_endpoint(fd);
+	SimEndpoint &sender = add_endpoint(*from.network, from.mac, from.timeout_us / 1000000);
+	memcpy(sender.peer.sll_addr, peer, ETH_ALEN);
+	transport_register(sender.fd, &sim_transport);
+	return sender.fd;
+}
+
+static void sim_set_peer(int fd, const uint8_t *mac) {
+	memcpy(sim_endpoint(fd).peer.sll_addr, mac, ETH_ALEN);
+}
+
+static const uint8_t *sim_last_source(int fd) {
+	return sim_endpoint(fd).last_source;
+}
+
+static const struct sockaddr_ll *sim_peer(int fd) {
+	return &sim_endpoint(fd).peer;
+}
+
+static void sim_close(int fd) {
+	unique_ptr<SimEndpoint> endpoint;
+	{
+		lock_guard<mutex> guard(endpoints_lock);
+		auto entry = endpoints.find(fd);
+		if (entry == endpoints.end()) {
+			return;
+		}
+		endpoint = move(entry->second);
+		endpoints.erase(entry);
+	}
+	{
+		lock_guard<mutex> guard(endpoint->network->lock);
+		vector<SimEndpoint *> &receivers = endpoint->network->receivers;
+		receivers.erase(remove(receivers.begin(), receivers.end(), endpoint.get()),
+						receivers.end());
+	}
+	close(fd);
+}
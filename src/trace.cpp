@@ -0,0 +1,83 @@
+#include "../inc/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include "../inc/rtt.h"
+
+static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0,
+			  "TRACE_RING_EVENTS must be a power of two");
+
+// An event packed in words, so that a reader racing a writer sees torn values and not undefined
+// behaviour. stamp is the event position + 1 once written, 0 while a writer fills the slot
+struct TraceSlot {
+	atomic<uint64_t> stamp;
+	atomic<uint64_t> time_us;
+	atomic<uint64_t> fields;  // type, 24 bits of value, session, sequence
+};
+
+static TraceSlot ring[TRACE_RING_EVENTS];
+static atomic<uint64_t> next_position(0);
+
+void trace_event(uint8_t type, uint16_t session, uint16_t sequence, uint32_t value) {
+	uint64_t position = next_position.fetch_add(1, memory_order_relaxed);
+	TraceSlot &slot = ring[position % TRACE_RING_EVENTS];
+	slot.stamp.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot.time_us.store(now_us(), memory_order_relaxed);
+	slot.fields.store((uint64_t)type << 56 | (uint64_t)(min(value, 0xFFFFFFu)) << 32 |
+						  (uint64_t)session << 16 | sequence,
+					  memory_order_relaxed);
+	slot.stamp.store(position + 1, memory_order_release);
+}
+
+string trace_type_name(uint8_t type) {
+	switch (type) {
+		case TRACE_SENT:
+			return "sent";
+		case TRACE_RESENT:
+			return "resent";
+		case TRACE_TIMEOUT:
+			return "timeout";
+		case TRACE_DELIVERED:
+			return "delivered";
+		case TRACE_NACK:
+			return "nack";
+		case TRACE_DUPLICATE:
+			return "duplicate";
+		case TRACE_CORRUPT:
+			return "corrupt";
+		case TRACE_REBUILT:
+			return "rebuilt";
+		case TRACE_WINDOW:
+			return "window";
+		default:
+			return "unknown";
+	}
+}
+
+bool trace_dump(const string &path) {
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr) {
+		return false;
+	}
+
+	uint64_t end = next_position.load(memory_order_acquire);
+	uint64_t start = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+	for (uint64_t position = start; position < end; position++) {
+		TraceSlot &slot = ring[position % TRACE_RING_EVENTS];
+		uint64_t stamp = slot.stamp.load(memory_order_acquire);
+		int64_t time_us = slot.time_us.load(memory_order_relaxed);
+		uint64_t fields = slot.fields.load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		// overwritten or still being written since it was read
+		if (stamp != position + 1 || slot.stamp.load(memory_order_relaxed) != stamp) {
+			continue;
+		}
+		fprintf(file, "%lld %s %u %u %u\n", (long long)time_us,
+				trace_type_name(fields >> 56).c_str(), (unsigned)(fields >> 16 & 0xFFFF),
+				(unsigned)(fields & 0xFFFF), (unsigned)(fields >> 32 & 0xFFFFFF));
+	}
+	return fclose(file) == 0;
+}
@@ -0,0 +1,63 @@
+#include "../inc/transport.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+// looked up on every packet, so a flat table indexed by descriptor instead of a locked map
+static atomic<const TransportOps *> transports[TRANSPORT_MAX_FDS];
+
+static const TransportOps &backend(int fd) {
+	const TransportOps *ops = nullptr;
+	if (fd >= 0 && fd < TRANSPORT_MAX_FDS) {
+		ops = transports[fd].load();
+	}
+	if (ops == nullptr) {
+		fprintf(stderr, "No transport for descriptor %d\n", fd);
+		abort();
+	}
+	return *ops;
+}
+
+void transport_register(int fd, const TransportOps *ops) {
+	if (fd < 0 || fd >= TRANSPORT_MAX_FDS) {
+		fprintf(stderr, "Descriptor %d past TRANSPORT_MAX_FDS\n", fd);
+		exit(EXIT_FAILURE);
+	}
+	transports[fd] = ops;
+}
+
+ssize_t transport_receive(int fd, uint8_t **packet, int64_t timeout_us) {
+	return backend(fd).receive(fd, packet, timeout_us);
+}
+
+void transport_send_batch(int fd, struct mmsghdr *messages, unsigned int count) {
+	backend(fd).send_batch(fd, messages, count);
+}
+
+int transport_create_sender(int fd, const uint8_t *peer) {
+	return backend(fd).create_sender(fd, peer);
+}
+
+int transport_clone_sender(int fd) {
+	return transport_create_sender(fd, transport_peer(fd)->sll_addr);
+}
+
+void transport_set_peer(int fd, const uint8_t *mac) {
+	backend(fd).set_peer(fd, mac);
+}
+
+const uint8_t *transport_last_source(int fd) {
+	return backend(fd).last_source(fd);
+}
+
+const struct sockaddr_ll *transport_peer(int fd) {
+	return backend(fd).peer(fd);
+}
+
+void transport_close(int fd) {
+	const TransportOps &ops = backend(fd);
+	// forgotten first, the descriptor number may be reused as soon as it is closed
+	transports[fd] = nullptr;
+	ops.close(fd);
+}
@@ -0,0 +1,67 @@
+#include "../inc/window.h"
+
+#include <algorithm>
+
+#include "../inc/frame.h"
+#include "../inc/trace.h"
+
+using namespace std;
+
+// the sequence of a window event is the one that made it change
+static void trace_window(SendWindow &window, uint16_t sequence) {
+	int frames = window_frames(window);
+	window.max_size = max(window.max_size, frames);
+	if (frames != window.last_traced) {
+		trace_event(TRACE_WINDOW, window.session, sequence, frames);
+	}
+	window.last_traced = frames;
+}
+
+void window_init(SendWindow &window, uint16_t session) {
+	window.size = WINDOW_SIZE;
+	window.threshold = WINDOW_MAX;
+	window.in_recovery = false;
+	window.recovery_end = 0;
+	window.max_size = WINDOW_SIZE;
+	window.last_traced = WINDOW_SIZE;
+	window.session = session;
+}
+
+int window_frames(const SendWindow &window) {
+	return (int)window.size;
+}
+
+void window_on_ack(SendWindow &window, uint16_t sequence, int acked_frames) {
+	if (window.in_recovery && seq_offset(window.recovery_end, sequence) < MAX_SEQ / 2) {
+		window.in_recovery = false;
+	}
+
+	if (window.size < window.threshold) {
+		// slow start: one more frame per frame acked, doubles every round trip
+		window.size += acked_frames;
+	} else {
+		// congestion avoidance: one more frame per round trip
+		window.size += (double)acked_frames / window.size;
+	}
+	window.size = min(window.size, (double)WINDOW_MAX);
+	trace_window(window, sequence);
+}
+
+void window_on_loss(SendWindow &window, uint16_t sequence, uint16_t next_sequence) {
+	// frames sent before the last decrease belong to the same loss event
+	if (window.in_recovery && seq_offset(sequence, window.recovery_end) < MAX_SEQ / 2) {
+		return;
+	}
+	window.threshold = max(window.size / 2, (double)WINDOW_MIN);
+	window.size = window.threshold;
+	window.in_recovery = true;
+	window.recovery_end = (next_sequence + MAX_SEQ - 1) % MAX_SEQ;
+	trace_window(window, sequence);
+}
+
+void window_on_timeout(SendWindow &window, uint16_t sequence) {
+	window.threshold = max(window.size / 2, (double)WINDOW_MIN);
+	window.size = WINDOW_MIN;
+	window.in_recovery = false;
+	trace_window(window, sequence);
+}
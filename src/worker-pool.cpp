@@ -0,0 +1,86 @@
+#include "../inc/worker-pool.h"
+
+// Own queue first, oldest job first, then the newest job of any other worker
+static bool take_job(WorkerPool &pool, int worker, Job &job) {
+	for (int i = 0; i < pool.workers; i++) {
+		WorkerQueue &queue = pool.queues[(worker + i) % pool.workers];
+		lock_guard<mutex> guard(queue.lock);
+		if (queue.jobs.empty()) {
+			continue;
+		}
+		if (i == 0) {
+			job = move(queue.jobs.front());
+			queue.jobs.pop_front();
+		} else {
+			job = move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		pool.pending--;
+		return true;
+	}
+	return false;
+}
+
+static void run_worker(WorkerPool &pool, int worker) {
+	Reactor reactor;
+	reactor_init(reactor);
+
+	while (true) {
+		Job job;
+		if (take_job(pool, worker, job)) {
+			job(reactor);
+			continue;
+		}
+
+		unique_lock<mutex> guard(pool.idle_lock);
+		pool.idle.wait(guard, [&]() { return pool.stopping || pool.pending > 0; });
+		if (pool.stopping && pool.pending == 0) {
+			break;
+		}
+	}
+
+	reactor_close(reactor);
+}
+
+void pool_start(WorkerPool &pool, int workers) {
+	if (workers <= 0) {
+		workers = max(1u, thread::hardware_concurrency());
+	}
+	pool.workers = workers;
+	pool.queues.reset(new WorkerQueue[workers]);
+	pool.next_queue = 0;
+	pool.pending = 0;
+	pool.stopping = false;
+
+	for (int i = 0; i < workers; i++) {
+		pool.threads.emplace_back(run_worker, ref(pool), i);
+	}
+}
+
+void pool_submit(WorkerPool &pool, Job job) {
+	WorkerQueue &queue = pool.queues[pool.next_queue++ % pool.workers];
+	{
+		lock_guard<mutex> guard(queue.lock);
+		queue.jobs.push_back(move(job));
+	}
+
+	// counted under the idle lock so a worker about to sleep can't miss it
+	{
+		lock_guard<mutex> guard(pool.idle_lock);
+		pool.pending++;
+	}
+	pool.idle.notify_one();
+}
+
+void pool_stop(WorkerPool &pool) {
+	{
+		lock_guard<mutex> guard(pool.idle_lock);
+		pool.stopping = true;
+	}
+	pool.idle.notify_all();
+
+	for (thread &worker : pool.threads) {
+		worker.join();
+	}
+	pool.threads.clear();
+}